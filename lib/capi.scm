@@ -0,0 +1,57 @@
+;;;; capi.scm - C interface for embedding the converter.
+
+(declare (uses converter)
+         (uses parser))
+
+(import (chicken condition)
+        (chicken foreign)
+        (chicken memory)
+        (chicken platform))
+
+(foreign-declare "
+int xpr_init(void)
+{
+    return CHICKEN_run(C_toplevel);
+}
+")
+
+;; The converter used by every call, which keeps its buffers between calls.
+(define library-converter (make-converter))
+
+;; Copy the first LEN characters of STR into the C buffer OUT of CAP bytes,
+;; terminating them with a NUL, and return LEN. Nothing is copied when they and
+;; the NUL do not fit.
+(define (string->buffer! str len out cap)
+  (when (< len cap)
+    (move-memory! str out len)
+    (pointer-u8-set! (pointer+ out len) 0))
+  len)
+
+;; Convert EXPR from IN_FIX to OUT_FIX, writing the result to the caller's
+;; buffer OUT of CAP bytes. See xpr-fix.h.
+(define-external (xpr_convert (c-string in_fix)
+                             (c-string out_fix)
+                             (c-string expr)
+                             (c-pointer out)
+                             (size_t cap))
+                 long
+  (handle-exceptions condition
+      (let ((message (get-condition-property condition 'exn 'message
+                                             "Unknown error")))
+        (string->buffer! message (string-length message) out cap)
+        -1)
+    (let ((input-fix (and in_fix (string->fix in_fix)))
+          (output-fix (and out_fix (string->fix out_fix))))
+      (unless (and input-fix
+                   output-fix
+                   expr
+                   (not (eq? input-fix 'c)))
+        (error "xpr_convert: Invalid argument"))
+      (converter-convert! library-converter input-fix output-fix expr)
+      (let ((output (converter-output library-converter)))
+        (string->buffer! (output-buffer-string output)
+                         (output-buffer-length output)
+                         out
+                         cap)))))
+
+(return-to-host)
@@ -0,0 +1,32 @@
+/* xpr-fix.h - C interface for embedding the converter. */
+
+#ifndef XPR_FIX_H
+#define XPR_FIX_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Start the CHICKEN runtime and load the converter. Call it once, before
+   any other function of the library. Returns nonzero on success. */
+int xpr_init(void);
+
+/* Convert the expression EXPR from the fix IN_FIX to the fix OUT_FIX, each
+   one of "pre", "prefix", "in", "infix", "post" or "postfix", and write the
+   NUL-terminated result to the caller's buffer OUT of CAP bytes. OUT_FIX
+   may also be "c", giving C functions xpr and xpr_n computing EXPR.
+
+   Returns the length of the result, excluding its NUL. When that is not
+   less than CAP, nothing is written, and the call may be repeated with a
+   large enough buffer. Returns -1 when the expression or a fix is invalid
+   or NULL, in which case the reason is written to OUT if it fits. */
+long xpr_convert(const char *in_fix, const char *out_fix, const char *expr,
+                 char *out, size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,221 @@
+;;;; batch.scm - Conversion of many expressions per process.
+
+(declare (unit batch)
+         (uses converter))
+
+(import (chicken condition)
+        (chicken file)
+        (chicken file posix)
+        (chicken format)
+        (chicken io)
+        (chicken port)
+        (chicken process)
+        (chicken string))
+
+;; Size of the buffers used for output, large enough that writing a traversal
+;; takes few system calls.
+(define output-buffer-size (* 1024 1024))
+
+;; Start of the error record written in place of an invalid expression's
+;; result, which is followed by its line number and the reason it is invalid.
+(define error-record-prefix "error: line ")
+
+;; Start of the error record written when expressions are located by the byte
+;; offset of their line instead of its number.
+(define offset-error-record-prefix "error: byte ")
+
+;; Get the reason given by an error condition: its message followed by its
+;; arguments.
+(define (condition-reason condition)
+  (call-with-output-string
+   (lambda (port)
+     (display (get-condition-property condition 'exn 'message "Unknown error")
+              port)
+     (for-each (lambda (argument)
+                 (display " " port)
+                 (write argument port))
+               (get-condition-property condition 'exn 'arguments '())))))
+
+;; Convert each line read from PORT, writing its result or error record to
+;; OUT, and return #t if every expression was valid. A file PORT stops at byte
+;; END, and BY-OFFSET gives line offsets instead of numbers in error records.
+(define (convert-lines converter input-fix output-fix port out
+                       #!optional end by-offset)
+  (let ((line-number 0)
+        (line-start 0)
+        (failures 0))
+    (define (next-line)
+      (if end
+          (begin (set! line-start (file-position port))
+                 (if (< line-start end)
+                     (read-line port)
+                     #!eof))
+          (read-line port)))
+    (define (convert-remaining-lines)
+      (let loop ()
+        (let ((line (next-line)))
+          (unless (eof-object? line)
+            (set! line-number (+ line-number 1))
+            (converter-convert! converter input-fix output-fix line out)
+            (newline out)
+            (loop)))))
+    (let resume ()
+      (when (handle-exceptions condition
+                (if ((condition-predicate 'i/o) condition)
+                    (abort condition)
+                    (begin
+                      (format out "~A~A: ~A~%"
+                              (if by-offset
+                                  offset-error-record-prefix
+                                  error-record-prefix)
+                              (if by-offset line-start line-number)
+                              (condition-reason condition))
+                      (set! failures (+ failures 1))
+                      #t))
+              (convert-remaining-lines)
+              #f)
+        (resume)))
+    (zero? failures)))
+
+;; Convert the lines of FILE starting within bytes START up to END, writing
+;; the results to the file OUTPUT, and return #t if every expression was
+;; valid.
+(define (convert-share converter input-fix output-fix file start end output
+                       by-offset)
+  (call-with-input-file file
+    (lambda (port)
+      ;; The line containing byte START - 1 belongs to the previous share.
+      (when (> start 0)
+        (set-file-position! port (- start 1))
+        (read-line port))
+      (call-with-output-file output
+        (lambda (out)
+          (set-buffering-mode! out #:full output-buffer-size)
+          (convert-lines converter input-fix output-fix port out
+                         end by-offset))))))
+
+;; Determine if every expression the worker process PID converted was valid,
+;; given the results of process-wait for it, raising an error if it failed.
+(define (worker-valid? pid normal status)
+  (cond ((and normal (= status 0)) #t)
+        ((and normal (= status 1)) #f)
+        (else (error "convert-file-parallel: Worker failed" pid status))))
+
+;; Wait for the workers of WORKERS, a vector of process IDs which are #f once
+;; waited for, that have not been waited for, and delete the files of OUTPUTS.
+(define (finish-workers! workers outputs)
+  (do ((i 0 (+ i 1)))
+      ((= i (vector-length workers)))
+    (when (vector-ref workers i)
+      (process-wait (vector-ref workers i))
+      (vector-set! workers i #f))
+    (when (and (vector-ref outputs i) (file-exists? (vector-ref outputs i)))
+      (delete-file (vector-ref outputs i)))))
+
+;; Write the contents of FILE to OUT in large blocks.
+(define (copy-file-contents file out)
+  (call-with-input-file file
+    (lambda (port)
+      (let loop ()
+        (let ((block (read-string output-buffer-size port)))
+          (unless (or (eof-object? block) (string=? block ""))
+            (display block out)
+            (loop)))))))
+
+;; Write the lines of FILE to OUT, adding LINE-OFFSET to the line numbers of
+;; its error records, and return the number of lines written.
+(define (copy-lines file out line-offset)
+  (define prefix-length (string-length error-record-prefix))
+  (call-with-input-file file
+    (lambda (port)
+      (let loop ((count 0))
+        (let ((line (read-line port)))
+          (if (eof-object? line)
+              count
+              (begin
+                (if (and (> (string-length line) prefix-length)
+                         (substring=? line error-record-prefix
+                                      0 0 prefix-length))
+                    (let ((end (substring-index ":" line prefix-length)))
+                      (format out "~A~A~A~%"
+                              error-record-prefix
+                              (+ line-offset
+                                 (string->number
+                                  (substring line prefix-length end)))
+                              (substring line end)))
+                    (begin (display line out)
+                           (newline out)))
+                (loop (+ count 1)))))))))
+
+;; Convert the lines of FILE with JOBS worker processes, each converting a
+;; byte range of it into a temporary file, and return #t if every expression
+;; was valid. The files are written to standard output in the order of their
+;; ranges when ORDERED, and otherwise as each worker finishes. When a worker
+;; or the merge fails, every worker is waited for and every file deleted
+;; before the error is raised again.
+(define (convert-file-parallel converter input-fix output-fix file jobs
+                               ordered)
+  (let ((size (file-size file))
+        (out (current-output-port))
+        (workers (make-vector jobs #f))
+        (outputs (make-vector jobs #f)))
+    (define (merge-ordered)
+      (let loop ((i 0)
+                 (line-offset 0)
+                 (valid #t))
+        (if (= i jobs)
+            valid
+            (let-values (((pid normal status)
+                          (process-wait (vector-ref workers i))))
+              (vector-set! workers i #f)
+              (let* ((worker-valid (worker-valid? pid normal status))
+                     (output (vector-ref outputs i))
+                     (lines (copy-lines output out line-offset)))
+                (delete-file output)
+                (loop (+ i 1)
+                      (+ line-offset lines)
+                      (and valid worker-valid)))))))
+    (define (merge-unordered)
+      (let loop ((remaining jobs)
+                 (valid #t))
+        (if (= remaining 0)
+            valid
+            (let-values (((pid normal status) (process-wait)))
+              (let find ((i 0))
+                (if (not (eqv? (vector-ref workers i) pid))
+                    (find (+ i 1))
+                    (begin
+                      (vector-set! workers i #f)
+                      (let ((worker-valid (worker-valid? pid normal status)))
+                        (copy-file-contents (vector-ref outputs i) out)
+                        (delete-file (vector-ref outputs i))
+                        (loop (- remaining 1)
+                              (and valid worker-valid))))))))))
+    (flush-output out)
+    (handle-exceptions condition
+        (begin
+          (finish-workers! workers outputs)
+          (abort condition))
+      (do ((i 0 (+ i 1)))
+          ((= i jobs))
+        (let ((output (create-temporary-file))
+              (start (quotient (* size i) jobs))
+              (end (quotient (* size (+ i 1)) jobs)))
+          (vector-set! outputs i output)
+          (vector-set! workers i
+                       (process-fork
+                        (lambda ()
+                          ;; The worker reports its own errors, leaving the
+                          ;; other workers and their files to the parent.
+                          (exit (handle-exceptions condition
+                                    (begin (print-error-message condition)
+                                           2)
+                                  (if (convert-share converter
+                                                     input-fix output-fix file
+                                                     start end output
+                                                     (not ordered))
+                                      0
+                                      1))))))))
+      (if ordered
+          (merge-ordered)
+          (merge-unordered)))))
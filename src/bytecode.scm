@@ -0,0 +1,220 @@
+;;;; bytecode.scm - Stack machine bytecode for expressions.
+
+(declare (unit bytecode)
+         (uses lexer)
+         (uses operator)
+         (uses symbols)
+         (uses tree))
+
+(import (chicken fixnum)
+        (chicken foreign)
+        srfi-4)
+
+(foreign-declare "
+static void xpr_operate(int opcode, double *values, unsigned int destination,
+                        unsigned int left, unsigned int right)
+{
+    double a = values[left], b = values[right];
+
+    switch (opcode) {
+    case 1: values[destination] = a + b; break;
+    case 2: values[destination] = a - b; break;
+    case 3: values[destination] = a * b; break;
+    default: values[destination] = a / b; break;
+    }
+}
+")
+
+;; Combine the values at LEFT and RIGHT of the f64vector VALUES with the
+;; operator of OPCODE, storing the result at DESTINATION.
+(define %operate!
+  (foreign-lambda void "xpr_operate"
+                  int f64vector unsigned-int unsigned-int unsigned-int))
+
+;; Copy the value at FROM-INDEX of the f64vector FROM to TO-INDEX of TO.
+(define %move-value!
+  (foreign-lambda* void ((f64vector to) (unsigned-int to_index)
+                         (f64vector from) (unsigned-int from_index))
+    "to[to_index] = from[from_index];"))
+
+;; Each instruction is a u32 whose low 8 bits are its opcode and whose other
+;; bits are its operand. Constant instructions push the constant whose index
+;; is their operand, variable instructions push the binding of the variable
+;; whose slot is their operand, and operator instructions, whose opcodes are
+;; one more than their operator codes, replace the top two values with the
+;; result. Store instructions copy the top value into the temporary whose
+;; index is their operand, and load instructions push it.
+(define opcode-constant 0)
+(define opcode-add 1)
+(define opcode-subtract 2)
+(define opcode-multiply 3)
+(define opcode-divide 4)
+(define opcode-variable 5)
+(define opcode-store 6)
+(define opcode-load 7)
+
+;; Number of constants or slots an instruction's operand can index.
+(define max-constant-count (fxshl 1 24))
+
+;; Compiled bytecode: the instructions, the constant pool, and the operand
+;; stack and temporaries the program runs on, which are allocated once at the
+;; size it needs.
+(define-record-type bytecode
+  (%make-bytecode code constants stack temporaries)
+  bytecode?
+  (code bytecode-code)
+  (constants bytecode-constants)
+  (stack bytecode-stack)
+  (temporaries bytecode-temporaries))
+
+;; Compile a token buffer holding a postfix expression into bytecode. Its
+;; identifiers are interned in SYMBOLS, or in a new symbol table when it is
+;; not given.
+(define (compile-bytecode tokens #!optional symbols)
+  (define count (token-buffer-length tokens))
+  (define table (or symbols (make-symbol-table)))
+  (define constant-count
+    (do ((i 0 (fx+ i 1))
+         (constants 0 (if (token-number? tokens i)
+                          (fx+ constants 1)
+                          constants)))
+        ((fx= i count) constants)))
+  (when (fx> constant-count max-constant-count)
+    (error "compile-bytecode: Too many constants" constant-count))
+  (let ((code (make-u32vector count 0))
+        (constants (make-f64vector constant-count 0.0)))
+    (let loop ((i 0)
+               (constant 0)
+               (depth 0)
+               (max-depth 0))
+      (cond ((fx= i count)
+             (unless (fx= depth 1)
+               (error "compile-bytecode: Invalid expression"))
+             (%make-bytecode code
+                             constants
+                             (make-f64vector max-depth 0.0)
+                             (make-f64vector 0 0.0)))
+            ((token-number? tokens i)
+             (f64vector-set! constants constant
+                             (exact->inexact (token-value tokens i)))
+             (u32vector-set! code i (fxior (fxshl constant 8) opcode-constant))
+             (loop (fx+ i 1)
+                   (fx+ constant 1)
+                   (fx+ depth 1)
+                   (fxmax max-depth (fx+ depth 1))))
+            ((token-identifier? tokens i)
+             (let ((slot (variable-slot
+                          (symbol-table-intern! table (token-value tokens i)))))
+               (when (fx>= slot max-constant-count)
+                 (error "compile-bytecode: Too many variables" slot))
+               (u32vector-set! code i (fxior (fxshl slot 8) opcode-variable)))
+             (loop (fx+ i 1)
+                   constant
+                   (fx+ depth 1)
+                   (fxmax max-depth (fx+ depth 1))))
+            ((and (binary-operator? (token-value tokens i))
+                  (fx>= depth 2))
+             (u32vector-set! code i (fx+ (token-operator-code tokens i) 1))
+             (loop (fx+ i 1) constant (fx- depth 1) max-depth))
+            (else
+             (error "compile-bytecode: Invalid expression"))))))
+
+;; Compile a binary tree into bytecode. In a shared pool, a node with several
+;; parents is computed once and stored in a temporary, which is loaded where
+;; its parents use it again.
+(define (compile-tree-bytecode tree #!optional pool)
+  (define parents (node-pool-parents pool tree))
+  ;; Temporaries of the shared nodes computed so far, indexed by node.
+  (define temporaries (and parents (make-vector (fx+ tree 1) #f)))
+  ;; The instructions and constants, which are only counted on the first
+  ;; pass, when they are #f.
+  (define code #f)
+  (define constants #f)
+  (define pc 0)
+  (define constant 0)
+  (define temporary 0)
+  (define max-depth 0)
+
+  (define (emit! opcode operand)
+    (when (fx>= operand max-constant-count)
+      (error "compile-tree-bytecode: Too many operands" operand))
+    (when code
+      (u32vector-set! code pc (fxior (fxshl operand 8) opcode)))
+    (set! pc (fx+ pc 1)))
+
+  ;; Emit the instructions pushing the value of a node onto a stack holding
+  ;; DEPTH values.
+  (define (push! node depth)
+    (set! max-depth (fxmax max-depth (fx+ depth 1)))
+    (if (and temporaries (vector-ref temporaries node))
+        (emit! opcode-load (vector-ref temporaries node))
+        (let ((root (node-root pool node))
+              (left (node-left pool node)))
+          (cond (left
+                 (push! left depth)
+                 (push! (node-right pool node) (fx+ depth 1))
+                 (emit! (fx+ (char->operator-code root) 1) 0))
+                ((variable? root)
+                 (emit! opcode-variable (variable-slot root)))
+                (else
+                 (when constants
+                   (f64vector-set! constants constant (exact->inexact root)))
+                 (emit! opcode-constant constant)
+                 (set! constant (fx+ constant 1))))
+          (when (and parents (fx> (s32vector-ref parents node) 1))
+            (vector-set! temporaries node temporary)
+            (emit! opcode-store temporary)
+            (set! temporary (fx+ temporary 1))))))
+
+  (push! tree 0)
+  (set! code (make-u32vector pc 0))
+  (set! constants (make-f64vector constant 0.0))
+  (set! pc 0)
+  (set! constant 0)
+  (set! temporary 0)
+  (when temporaries
+    (vector-fill! temporaries #f))
+  (push! tree 0)
+  (%make-bytecode code
+                  constants
+                  (make-f64vector max-depth 0.0)
+                  (make-f64vector temporary 0.0)))
+
+;; Run bytecode, leaving the value it computes at the bottom of its operand
+;; stack, its variables taking their values from BINDINGS, an f64vector
+;; indexed by variable slot. Values are only moved and combined by C helpers,
+;; so no flonum is boxed and a run allocates nothing. Division by zero
+;; follows IEEE 754.
+(define (run-bytecode! bytecode #!optional bindings)
+  (let* ((code (bytecode-code bytecode))
+         (constants (bytecode-constants bytecode))
+         (stack (bytecode-stack bytecode))
+         (temporaries (bytecode-temporaries bytecode))
+         (end (u32vector-length code)))
+    (let loop ((pc 0)
+               (sp 0))
+      (unless (fx= pc end)
+        (let* ((instruction (u32vector-ref code pc))
+               (opcode (fxand instruction 255))
+               (operand (fxshr instruction 8)))
+          (cond
+           ((fx= opcode opcode-constant)
+            (%move-value! stack sp constants operand)
+            (loop (fx+ pc 1) (fx+ sp 1)))
+           ((fx= opcode opcode-variable)
+            (%move-value! stack sp bindings operand)
+            (loop (fx+ pc 1) (fx+ sp 1)))
+           ((fx= opcode opcode-store)
+            (%move-value! temporaries operand stack (fx- sp 1))
+            (loop (fx+ pc 1) sp))
+           ((fx= opcode opcode-load)
+            (%move-value! stack sp temporaries operand)
+            (loop (fx+ pc 1) (fx+ sp 1)))
+           (else
+            (%operate! opcode stack (fx- sp 2) (fx- sp 2) (fx- sp 1))
+            (loop (fx+ pc 1) (fx- sp 1)))))))))
+
+;; Run bytecode and return the value it computes, as run-bytecode! does.
+(define (run-bytecode bytecode #!optional bindings)
+  (run-bytecode! bytecode bindings)
+  (f64vector-ref (bytecode-stack bytecode) 0))
@@ -0,0 +1,302 @@
+;;;; columns.scm - Columnar evaluation of expressions.
+
+(declare (unit columns)
+         (uses symbols)
+         (uses tree))
+
+(import (chicken fixnum)
+        (chicken flonum)
+        srfi-4)
+
+;; Number of rows evaluated at a time, small enough that the scratch columns
+;; of an expression stay in cache.
+(define default-chunk-size 1024)
+
+;; Define a kernel applying the flonum operation OPERATE to COUNT elements of
+;; the columns LEFT and RIGHT, starting at LEFT-START and RIGHT-START, and
+;; storing the results in DESTINATION from DESTINATION-START. Either operand
+;; may instead be a flonum constant. The shape of the operands is dispatched
+;; on once per call, outside the loop.
+(define-syntax define-column-kernel
+  (syntax-rules ()
+    ((_ name operate)
+     (define (name destination destination-start
+                   left left-start
+                   right right-start
+                   count)
+       (cond ((flonum? left)
+              (do ((i 0 (fx+ i 1)))
+                  ((fx= i count))
+                (f64vector-set! destination (fx+ destination-start i)
+                                (operate left
+                                         (f64vector-ref right
+                                                        (fx+ right-start i))))))
+             ((flonum? right)
+              (do ((i 0 (fx+ i 1)))
+                  ((fx= i count))
+                (f64vector-set! destination (fx+ destination-start i)
+                                (operate (f64vector-ref left
+                                                        (fx+ left-start i))
+                                         right))))
+             (else
+              (do ((i 0 (fx+ i 1)))
+                  ((fx= i count))
+                (f64vector-set! destination (fx+ destination-start i)
+                                (operate (f64vector-ref left
+                                                        (fx+ left-start i))
+                                         (f64vector-ref
+                                          right
+                                          (fx+ right-start i)))))))))))
+
+(define-column-kernel add-columns! fp+)
+(define-column-kernel subtract-columns! fp-)
+(define-column-kernel multiply-columns! fp*)
+(define-column-kernel divide-columns! fp/)
+
+;; Get the kernel computing a binary operator over columns.
+(define (operator-column-kernel operator)
+  (case operator
+    ((#\+) add-columns!)
+    ((#\-) subtract-columns!)
+    ((#\*) multiply-columns!)
+    ((#\/) divide-columns!)
+    (else (error "operator-column-kernel: Invalid operator" operator))))
+
+;; Get the flonum operation computing a binary operator.
+(define (operator-flonum-procedure operator)
+  (case operator
+    ((#\+) fp+)
+    ((#\-) fp-)
+    ((#\*) fp*)
+    ((#\/) fp/)
+    (else (error "operator-flonum-procedure: Invalid operator" operator))))
+
+;; A column program evaluates the trees at several roots of a node pool over
+;; columns of rows, one chunk of rows at a time. Its operands are pairs of a
+;; kind and a value: a constant and its flonum value, a column and its
+;; variable's slot, an output and its index, or a buffer and the index of a
+;; scratch column. Each step is a vector of a kernel and its destination, left
+;; and right operands, run in order for each chunk, and each copy is a pair of
+;; an output index and the operand whose values it is given.
+(define-record-type column-program
+  (%make-column-program steps copies buffer-count output-count)
+  column-program?
+  (steps column-program-steps)
+  (copies column-program-copies)
+  (buffer-count column-program-buffer-count)
+  (output-count column-program-output-count))
+
+;; Compile the trees at the node indexes ROOTS of a node pool into a column
+;; program computing one output for each root.
+;;
+;; Nodes are visited in index order, which puts every node after its
+;; children. Constant subtrees are folded, and each node shared by several
+;; parents is computed once. The result of an operator node is stored in the
+;; output of the first root it is, or otherwise in a scratch column. Scratch
+;; columns are reused as soon as the last node reading them is computed,
+;; including by that node itself, since kernels work element by element, so
+;; few are needed.
+(define (compile-column-program pool roots)
+  (let* ((size (node-pool-length pool))
+         (uses (make-s32vector size 0))
+         (reachable (make-u8vector size 0))
+         (outputs (make-vector size #f))
+         (operands (make-vector size #f))
+         (free-buffers '())
+         (buffer-count 0)
+         (steps '()))
+    ;; Count a use of NODE, marking it and its descendants reachable.
+    (define (use! node)
+      (s32vector-set! uses node (fx+ (s32vector-ref uses node) 1))
+      (when (fx= (u8vector-ref reachable node) 0)
+        (u8vector-set! reachable node 1)
+        (let ((left (node-pool-left pool node)))
+          (when left
+            (use! left)
+            (use! (node-pool-right pool node))))))
+    ;; Release a use of NODE, freeing its scratch column after the last one.
+    (define (release! node)
+      (let ((remaining (fx- (s32vector-ref uses node) 1))
+            (operand (vector-ref operands node)))
+        (s32vector-set! uses node remaining)
+        (when (and (fx= remaining 0) (eq? (car operand) 'buffer))
+          (set! free-buffers (cons (cdr operand) free-buffers)))))
+    (define (allocate-buffer!)
+      (if (pair? free-buffers)
+          (let ((buffer (car free-buffers)))
+            (set! free-buffers (cdr free-buffers))
+            buffer)
+          (begin (set! buffer-count (fx+ buffer-count 1))
+                 (fx- buffer-count 1))))
+
+    (for-each use! roots)
+    (let loop ((roots roots)
+               (output 0))
+      (when (pair? roots)
+        (unless (vector-ref outputs (car roots))
+          (vector-set! outputs (car roots) output))
+        (loop (cdr roots) (fx+ output 1))))
+    (do ((node 0 (fx+ node 1)))
+        ((fx= node size))
+      (when (fx= (u8vector-ref reachable node) 1)
+        (let ((root (node-pool-root pool node))
+              (left (node-pool-left pool node)))
+          (vector-set!
+           operands node
+           (cond ((not left)
+                  (if (variable? root)
+                      (cons 'column (variable-slot root))
+                      (cons 'constant (exact->inexact root))))
+                 (else
+                  (let* ((right (node-pool-right pool node))
+                         (left-operand (vector-ref operands left))
+                         (right-operand (vector-ref operands right)))
+                    (if (and (eq? (car left-operand) 'constant)
+                             (eq? (car right-operand) 'constant))
+                        (cons 'constant
+                              ((operator-flonum-procedure root)
+                               (cdr left-operand)
+                               (cdr right-operand)))
+                        (begin
+                          (release! left)
+                          (release! right)
+                          (let ((destination
+                                 (if (vector-ref outputs node)
+                                     (cons 'output (vector-ref outputs node))
+                                     (cons 'buffer (allocate-buffer!)))))
+                            (set! steps
+                                  (cons (vector (operator-column-kernel root)
+                                                destination
+                                                left-operand
+                                                right-operand)
+                                        steps))
+                            destination))))))))))
+    (let loop ((roots roots)
+               (output 0)
+               (copies '()))
+      (if (pair? roots)
+          (let ((operand (vector-ref operands (car roots))))
+            (loop (cdr roots)
+                  (fx+ output 1)
+                  (if (equal? operand (cons 'output output))
+                      copies
+                      (cons (cons output operand) copies))))
+          (%make-column-program (reverse steps)
+                                (reverse copies)
+                                buffer-count
+                                (length roots))))))
+
+;; Merge binary trees into one shared node pool, where equal subtrees share a
+;; node, returning the pool and a list of the index of each tree's root node.
+;; When SOURCE is given, TREES are the indexes of their root nodes within it.
+(define (merge-trees trees #!optional source)
+  (define pool (make-node-pool 64 #t))
+  ;; Indexes of the merged nodes of SOURCE, so that the nodes it shares are
+  ;; merged once.
+  (define merged (and source (make-vector (node-pool-length source) #f)))
+  (define (merge node)
+    (or (and merged (vector-ref merged node))
+        (let ((index (if (node-left source node)
+                         (let* ((left (merge (node-left source node)))
+                                (right (merge (node-right source node))))
+                           (node-pool-add! pool
+                                           (node-root source node)
+                                           left
+                                           right))
+                         (node-pool-add! pool (node-root source node)))))
+          (when merged
+            (vector-set! merged node index))
+          index)))
+  (let ((roots (map merge trees)))
+    (values pool roots)))
+
+;; Get the number of rows of COLUMNS, a vector of f64vectors indexed by
+;; variable slot, which must all be of the same length.
+(define (column-rows columns)
+  (let loop ((slot 0)
+             (rows #f))
+    (if (fx= slot (vector-length columns))
+        (or rows (error "column-rows: No columns"))
+        (let ((column (vector-ref columns slot)))
+          (if (and rows column (not (fx= rows (f64vector-length column))))
+              (error "column-rows: Columns differ in length")
+              (loop (fx+ slot 1)
+                    (if column (f64vector-length column) rows)))))))
+
+;; Run a column program over COLUMNS, a vector of f64vectors indexed by
+;; variable slot, CHUNK-SIZE rows at a time, and return a vector of its
+;; outputs as f64vectors.
+(define (run-column-program program columns #!optional
+                            (chunk-size default-chunk-size))
+  (let* ((rows (column-rows columns))
+         (outputs (make-vector (column-program-output-count program) #f))
+         (buffers (make-vector (column-program-buffer-count program) #f)))
+    (do ((i 0 (fx+ i 1)))
+        ((fx= i (vector-length outputs)))
+      (vector-set! outputs i (make-f64vector rows 0.0)))
+    (do ((i 0 (fx+ i 1)))
+        ((fx= i (vector-length buffers)))
+      (vector-set! buffers i (make-f64vector chunk-size 0.0)))
+    (let chunk ((start 0))
+      (when (fx< start rows)
+        (let ((count (fxmin chunk-size (fx- rows start))))
+          ;; Get the vector of an operand, or the value of a constant.
+          (define (operand-vector operand)
+            (case (car operand)
+              ((constant) (cdr operand))
+              ((column) (vector-ref columns (cdr operand)))
+              ((output) (vector-ref outputs (cdr operand)))
+              ((buffer) (vector-ref buffers (cdr operand)))))
+          ;; Get the index of the chunk's first row in an operand's vector.
+          (define (operand-start operand)
+            (if (eq? (car operand) 'buffer) 0 start))
+          (for-each
+           (lambda (step)
+             (let ((destination (vector-ref step 1))
+                   (left (vector-ref step 2))
+                   (right (vector-ref step 3)))
+               ((vector-ref step 0)
+                (operand-vector destination) (operand-start destination)
+                (operand-vector left) (operand-start left)
+                (operand-vector right) (operand-start right)
+                count)))
+           (column-program-steps program))
+          (for-each
+           (lambda (copy)
+             (let ((output (vector-ref outputs (car copy)))
+                   (source (operand-vector (cdr copy)))
+                   (source-start (operand-start (cdr copy))))
+               (do ((i 0 (fx+ i 1)))
+                   ((fx= i count))
+                 (f64vector-set! output (fx+ start i)
+                                 (if (flonum? source)
+                                     source
+                                     (f64vector-ref source
+                                                    (fx+ source-start i)))))))
+           (column-program-copies program))
+          (chunk (fx+ start chunk-size)))))
+    outputs))
+
+;; Evaluate a binary tree over COLUMNS, a vector of f64vectors indexed by
+;; variable slot, returning an f64vector of its value for each row. Whole
+;; chunks of rows are computed one operator at a time, in flonum arithmetic,
+;; and repeated subtrees of a tree record are computed once.
+(define (eval-columns tree columns #!optional pool
+                      (chunk-size default-chunk-size))
+  (let* ((pool* (or pool (make-node-pool 64 #t)))
+         (root (if pool tree (node-pool-add-tree! pool* tree))))
+    (vector-ref (run-column-program (compile-column-program pool* (list root))
+                                    columns
+                                    chunk-size)
+                0)))
+
+;; Evaluate several binary trees over COLUMNS, a vector of f64vectors indexed
+;; by variable slot, returning a list of an f64vector of the values of each
+;; tree. The trees are merged so that each chunk of rows is read once for all
+;; of them, and subexpressions they share are computed once.
+(define (eval-columns-fused trees columns #!optional pool
+                            (chunk-size default-chunk-size))
+  (let-values (((merged roots) (merge-trees trees pool)))
+    (vector->list (run-column-program (compile-column-program merged roots)
+                                      columns
+                                      chunk-size))))
@@ -0,0 +1,227 @@
+;;;; converter.scm - Reusable expression converter.
+
+(declare (unit converter)
+         (uses bytecode)
+         (uses evaluator)
+         (uses jit)
+         (uses lexer)
+         (uses optimizer)
+         (uses parser)
+         (uses registers)
+         (uses stack)
+         (uses symbols)
+         (uses tree))
+
+(import (chicken memory)
+        (chicken port)
+        srfi-4)
+
+;; An output buffer collects the strings written to it in a single string,
+;; which is kept for reuse when the buffer is cleared.
+(define-record-type output-buffer
+  (%make-output-buffer string length)
+  output-buffer?
+  (string output-buffer-string output-buffer-string-set!)
+  (length output-buffer-length output-buffer-length-set!))
+
+;; Make an empty output buffer with room for CAPACITY characters before it
+;; must grow.
+(define (make-output-buffer #!optional (capacity 256))
+  (%make-output-buffer (make-string (max capacity 1)) 0))
+
+;; Remove the contents of an output buffer, keeping its storage.
+(define (output-buffer-clear! buffer)
+  (output-buffer-length-set! buffer 0))
+
+;; Append STR to an output buffer.
+(define (output-buffer-write! buffer str)
+  (let* ((length (output-buffer-length buffer))
+         (str-length (string-length str))
+         (new-length (+ length str-length))
+         (capacity (string-length (output-buffer-string buffer))))
+    (when (> new-length capacity)
+      (let ((new-string (make-string (max new-length (* 2 capacity)))))
+        (move-memory! (output-buffer-string buffer) new-string length)
+        (output-buffer-string-set! buffer new-string)))
+    (move-memory! str (output-buffer-string buffer) str-length 0 length)
+    (output-buffer-length-set! buffer new-length)))
+
+;; Get the contents of an output buffer as a new string.
+(define (output-buffer->string buffer)
+  (substring (output-buffer-string buffer) 0 (output-buffer-length buffer)))
+
+;; Make an output port that appends what is written to it to an output
+;; buffer.
+(define (make-output-buffer-port buffer)
+  (make-output-port (lambda (str)
+                      (output-buffer-write! buffer str))
+                    void))
+
+;; A converter owns the buffers, symbol table and bindings its conversions
+;; reuse. Its pool is the shared one when the last tree parsed was folded or
+;; evaluated, and the plain one otherwise.
+(define-record-type converter
+  (%make-converter tokens pool plain-pool shared-pool operands operators
+                   output port symbols bindings fold c-name)
+  converter?
+  (tokens converter-tokens)
+  (pool converter-pool converter-pool-set!)
+  (plain-pool converter-plain-pool)
+  (shared-pool converter-shared-pool)
+  (operands converter-operands)
+  (operators converter-operators)
+  (output converter-output)
+  (port converter-port)
+  (symbols converter-symbols)
+  (bindings converter-bindings converter-bindings-set!)
+  (fold converter-fold? converter-fold-set!)
+  (c-name converter-c-name converter-c-name-set!))
+
+;; Make a converter.
+(define (make-converter)
+  (let ((output (make-output-buffer))
+        (pool (make-node-pool)))
+    (%make-converter (make-token-buffer)
+                     pool
+                     pool
+                     (make-node-pool 64 #t)
+                     (make-stack '())
+                     (make-stack '())
+                     output
+                     (make-output-buffer-port output)
+                     (make-symbol-table)
+                     (make-vector 0)
+                     #f
+                     "xpr")))
+
+;; Bind the variable named NAME to VALUE when the converter evaluates
+;; expressions.
+(define (converter-bind! converter name value)
+  (converter-reset-symbols! converter)
+  (let ((slot (variable-slot (symbol-table-intern! (converter-symbols converter)
+                                                   name)))
+        (bindings (converter-bindings converter)))
+    (when (>= slot (vector-length bindings))
+      (set! bindings (vector-resize bindings (+ slot 1) #f))
+      (converter-bindings-set! converter bindings))
+    (vector-set! bindings slot value)))
+
+;; Remove the variables of earlier conversions from the converter's symbol
+;; table, keeping only the bound ones.
+(define (converter-reset-symbols! converter)
+  (symbol-table-truncate! (converter-symbols converter)
+                          (vector-length (converter-bindings converter))))
+
+;; Lex the expression string XPR into the converter's token buffer.
+(define (converter-lex! converter xpr)
+  (lex-xpr xpr (converter-tokens converter)))
+
+;; Parse the converter's tokens, written in FIX, into its shared node pool
+;; when SHARED is true and into its plain one otherwise, and return the index
+;; of the tree's root node.
+(define (converter-parse! converter fix #!optional shared)
+  (let ((pool (if shared
+                  (converter-shared-pool converter)
+                  (converter-plain-pool converter))))
+    (node-pool-clear! pool)
+    (converter-pool-set! converter pool))
+  (converter-reset-symbols! converter)
+  (parse-xpr fix
+             (converter-tokens converter)
+             (converter-pool converter)
+             (converter-operands converter)
+             (converter-operators converter)
+             (converter-symbols converter)))
+
+;; Check that every variable of the tree at node ROOT of the converter's node
+;; pool is bound, for evaluators that read bindings without checking them.
+(define (converter-check-bindings converter root)
+  (let ((bindings (converter-bindings converter)))
+    (for-each (lambda (variable)
+                (unless (and (< (variable-slot variable)
+                                (vector-length bindings))
+                             (vector-ref bindings (variable-slot variable)))
+                  (error "Unbound variable" (variable-name variable))))
+              (tree-variables root (converter-pool converter)))))
+
+;; Get the converter's bindings as an f64vector indexed by slot, for
+;; evaluators computing with flonums. Every variable of the tree at node ROOT
+;; of its node pool must be bound.
+(define (converter-flonum-bindings converter root)
+  (let* ((bindings (converter-bindings converter))
+         (flonums (make-f64vector (vector-length bindings) 0.0)))
+    (converter-check-bindings converter root)
+    (do ((slot 0 (+ slot 1)))
+        ((= slot (vector-length bindings)) flonums)
+      (when (vector-ref bindings slot)
+        (f64vector-set! flonums slot
+                        (exact->inexact (vector-ref bindings slot)))))))
+
+;; Determine if an output fix evaluates expressions instead of converting
+;; them: value walks the tree, closure calls closures compiled from it,
+;; bytecode runs it on a stack machine, registers runs it on a register
+;; machine, and jit runs native code. The last three compute with flonums,
+;; where the first two compute with exact numbers when they are given them.
+(define (evaluation-fix? fix)
+  (and (memq fix '(value closure bytecode registers jit)) #t))
+
+;; Write a traversal in FIX of the tree at node ROOT of the converter's node
+;; pool to PORT, or its value when FIX is an evaluation fix.
+(define (converter-write converter fix root port)
+  (case fix
+    ((value)
+     (display (eval-tree root
+                         (converter-pool converter)
+                         (converter-bindings converter))
+              port))
+    ((closure)
+     (converter-check-bindings converter root)
+     (display ((compile-tree root (converter-pool converter))
+               (converter-bindings converter))
+              port))
+    ((bytecode)
+     (display (run-bytecode (compile-tree-bytecode root
+                                                   (converter-pool converter))
+                            (converter-flonum-bindings converter root))
+              port))
+    ((registers)
+     (display (run-registers (compile-registers root (converter-pool converter))
+                             (converter-flonum-bindings converter root))
+              port))
+    ((jit)
+     (display (jit-call (jit-compile root (converter-pool converter))
+                        (converter-flonum-bindings converter root))
+              port))
+    (else
+     (write-traversal fix
+                      root
+                      port
+                      (converter-pool converter)
+                      (converter-c-name converter)))))
+
+;; Convert the expression string XPR from INPUT-FIX to OUTPUT-FIX, which may be
+;; an evaluation fix, writing the result to PORT, or when PORT is not given, to
+;; the converter's output buffer, which is cleared first. The tree is
+;; simplified first when evaluating it or when the converter folds, with zero
+;; as an annihilator only in the latter case.
+(define (converter-convert! converter input-fix output-fix xpr #!optional port)
+  (converter-lex! converter xpr)
+  (let* ((fold (or (converter-fold? converter) (evaluation-fix? output-fix)))
+         (root (converter-parse! converter input-fix fold))
+         (root (if fold
+                   (fold-pool! (converter-pool converter)
+                               root
+                               (not (evaluation-fix? output-fix)))
+                   root)))
+    (if port
+        (converter-write converter output-fix root port)
+        (begin
+          (output-buffer-clear! (converter-output converter))
+          (converter-write converter output-fix root
+                           (converter-port converter))))))
+
+;; Convert the expression string XPR from INPUT-FIX to OUTPUT-FIX and return
+;; the result as a new string.
+(define (converter-convert converter input-fix output-fix xpr)
+  (converter-convert! converter input-fix output-fix xpr)
+  (output-buffer->string (converter-output converter)))
@@ -0,0 +1,173 @@
+;;;; evaluator.scm - Mathematical expression evaluator.
+
+(declare (unit evaluator)
+         (uses symbols)
+         (uses tree))
+
+(import (chicken fixnum)
+        (chicken flonum))
+
+;; Arithmetic on numbers, with fast paths for fixnum and flonum operands.
+;; Fixnum results overflow into bignums. Dividing by an exact zero is an
+;; error, while dividing by an inexact zero gives an infinity or NaN as in
+;; IEEE 754.
+
+(define (add-numbers left right)
+  (cond ((and (fixnum? left) (fixnum? right))
+         (or (fx+? left right) (+ left right)))
+        ((and (flonum? left) (flonum? right))
+         (fp+ left right))
+        (else (+ left right))))
+
+(define (subtract-numbers left right)
+  (cond ((and (fixnum? left) (fixnum? right))
+         (or (fx-? left right) (- left right)))
+        ((and (flonum? left) (flonum? right))
+         (fp- left right))
+        (else (- left right))))
+
+(define (multiply-numbers left right)
+  (cond ((and (fixnum? left) (fixnum? right))
+         (or (fx*? left right) (* left right)))
+        ((and (flonum? left) (flonum? right))
+         (fp* left right))
+        (else (* left right))))
+
+(define (divide-numbers left right)
+  (cond ((and (fixnum? left) (fixnum? right))
+         (cond ((fx= right 0)
+                (error "Division by zero" left))
+               ((fx= (fxrem left right) 0)
+                (or (fx/? left right) (quotient left right)))
+               (else (/ left right))))
+        ((and (flonum? left) (flonum? right))
+         (fp/ left right))
+        ((and (exact? right) (zero? right))
+         (error "Division by zero" left))
+        (else (/ left right))))
+
+;; Get the procedure computing a binary operator.
+(define (operator-procedure operator)
+  (case operator
+    ((#\+) add-numbers)
+    ((#\-) subtract-numbers)
+    ((#\*) multiply-numbers)
+    ((#\/) divide-numbers)
+    (else (error "operator-procedure: Invalid operator" operator))))
+
+;; Apply a binary operator to two numbers.
+(define (apply-operator operator left right)
+  ((operator-procedure operator) left right))
+
+;; Get the value of a variable from BINDINGS, a vector of values indexed by
+;; variable slot, where #f marks an unbound variable.
+(define (variable-value variable bindings)
+  (let ((slot (variable-slot variable)))
+    (or (and bindings
+             (fx< slot (vector-length bindings))
+             (vector-ref bindings slot))
+        (error "Unbound variable" (variable-name variable)))))
+
+;; Get the value of a leaf's root: a number, or a variable bound in BINDINGS.
+(define (leaf-value root bindings)
+  (if (variable? root)
+      (variable-value root bindings)
+      root))
+
+;; Compute the value of a binary tree, its variables taking their values from
+;; BINDINGS, a vector of values indexed by variable slot. In a shared pool the
+;; value of each node is computed once however many parents it has.
+(define (eval-tree tree #!optional pool bindings)
+  (let ((computed (and pool
+                       (node-pool-shared? pool)
+                       (make-vector (fx+ tree 1) #f))))
+    (let eval-node ((node tree))
+      (or (and computed (vector-ref computed node))
+          (let* ((left (node-left pool node))
+                 (value (if left
+                            (apply-operator (node-root pool node)
+                                            (eval-node left)
+                                            (eval-node (node-right pool node)))
+                            (leaf-value (node-root pool node) bindings))))
+            (when computed
+              (vector-set! computed node value))
+            value)))))
+
+;; Make the closure computing a binary operator with the procedure OPERATE
+;; from the compiled operands LEFT and RIGHT, specialized by which of them are
+;; constants, variables read straight from their slot, or closures, or compute
+;; the constant result when both are constants.
+(define-syntax specialize-operator
+  (syntax-rules ()
+    ((_ operate left right)
+     (let ((left-slot (and (variable? left) (variable-slot left)))
+           (right-slot (and (variable? right) (variable-slot right))))
+       (cond ((and (number? left) (number? right))
+              (operate left right))
+             ((number? left)
+              (if right-slot
+                  (lambda (bindings)
+                    (operate left (vector-ref bindings right-slot)))
+                  (lambda (bindings)
+                    (operate left (right bindings)))))
+             ((number? right)
+              (if left-slot
+                  (lambda (bindings)
+                    (operate (vector-ref bindings left-slot) right))
+                  (lambda (bindings)
+                    (operate (left bindings) right))))
+             (left-slot
+              (if right-slot
+                  (lambda (bindings)
+                    (operate (vector-ref bindings left-slot)
+                             (vector-ref bindings right-slot)))
+                  (lambda (bindings)
+                    (operate (vector-ref bindings left-slot)
+                             (right bindings)))))
+             (right-slot
+              (lambda (bindings)
+                (operate (left bindings) (vector-ref bindings right-slot))))
+             (else
+              (lambda (bindings)
+                (operate (left bindings) (right bindings)))))))))
+
+;; Compile a binary tree into a procedure of one argument, the bindings of the
+;; expression's variables as a vector of values indexed by variable slot,
+;; which must hold a value for each, returning its value. Each operator node
+;; becomes a closure specialized for its operator and the kinds of its
+;; operands, so calling the procedure never dispatches on a node's root, and
+;; constant subtrees are computed once when compiling. In a shared pool each
+;; node is compiled once however many parents it has, and its parents share
+;; its closure.
+(define (compile-tree tree #!optional pool)
+  (define compiled
+    (and pool (node-pool-shared? pool) (make-vector (fx+ tree 1) #f)))
+
+  ;; Compile a node into its closure, or its value or variable when it is a
+  ;; leaf.
+  (define (compile-node node)
+    (or (and compiled (vector-ref compiled node))
+        (let ((result
+               (if (node-left pool node)
+                   (let ((left (compile-node (node-left pool node)))
+                         (right (compile-node (node-right pool node))))
+                     (case (node-root pool node)
+                       ((#\+) (specialize-operator add-numbers left right))
+                       ((#\-) (specialize-operator subtract-numbers left right))
+                       ((#\*) (specialize-operator multiply-numbers left right))
+                       ((#\/) (specialize-operator divide-numbers left right))
+                       (else
+                        (error "compile-tree: Invalid operator"
+                               (node-root pool node)))))
+                   (node-root pool node))))
+          (when compiled
+            (vector-set! compiled node result))
+          result)))
+
+  (let ((result (compile-node tree)))
+    (cond ((number? result)
+           (lambda (bindings) result))
+          ((variable? result)
+           (let ((slot (variable-slot result)))
+             (lambda (bindings) (vector-ref bindings slot))))
+          (else result))))
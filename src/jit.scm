@@ -0,0 +1,170 @@
+;;;; jit.scm - Native compilation of expressions.
+
+(declare (unit jit)
+         (uses columns)
+         (uses symbols)
+         (uses tree))
+
+(import (chicken bitwise)
+        (chicken file)
+        (chicken foreign)
+        (chicken io)
+        (chicken process)
+        (chicken process-context)
+        (chicken process-context posix)
+        srfi-4)
+
+(foreign-declare "
+#include <dlfcn.h>
+
+static double xpr_jit_call(void *function, double *vars)
+{
+    return ((double (*)(const double *))function)(vars);
+}
+
+static void xpr_jit_call_n(void *function, size_t n, C_word columns,
+                           double *out)
+{
+    size_t count = C_header_size(columns), i;
+    const double *pointers[count > 0 ? count : 1];
+
+    for (i = 0; i < count; i++) {
+        C_word column = C_block_item(columns, i);
+        pointers[i] = C_truep(column) ? (const double *)C_srfi_4_vector(column)
+                                      : NULL;
+    }
+    ((void (*)(size_t, const double *const *, double *))function)(n, pointers,
+                                                                  out);
+}
+")
+
+(define %dlopen (foreign-lambda c-pointer "dlopen" c-string int))
+(define %dlsym (foreign-lambda c-pointer "dlsym" c-pointer c-string))
+(define %dlerror (foreign-lambda c-string "dlerror"))
+(define dlopen-now (foreign-value "RTLD_NOW" int))
+(define %jit-call (foreign-lambda double "xpr_jit_call" c-pointer f64vector))
+(define %jit-call-n
+  (foreign-lambda void "xpr_jit_call_n" c-pointer size_t scheme-object
+                  f64vector))
+
+;; A natively compiled expression: the pointers to its scalar function and to
+;; its array kernel, as written by the c fix, and the slots of the variables
+;; they read.
+(define-record-type jit-function
+  (make-jit-function scalar array slots)
+  jit-function?
+  (scalar jit-function-scalar)
+  (array jit-function-array)
+  (slots jit-function-slots))
+
+;; Get the directory holding compiled expressions: XPR_FIX_CACHE, or
+;; xpr-fix within XDG_CACHE_HOME or ~/.cache.
+(define (jit-cache-directory)
+  (or (get-environment-variable "XPR_FIX_CACHE")
+      (let ((cache (get-environment-variable "XDG_CACHE_HOME")))
+        (if (and cache (not (string=? cache "")))
+            (string-append cache "/xpr-fix")
+            (string-append (or (get-environment-variable "HOME") ".")
+                           "/.cache/xpr-fix")))))
+
+;; Hash a string with 32 bit FNV-1a.
+(define (source-hash str)
+  (let ((length (string-length str)))
+    (do ((i 0 (+ i 1))
+         (hash 2166136261
+               (modulo (* (bitwise-xor hash (char->integer (string-ref str i)))
+                          16777619)
+                       4294967296)))
+        ((= i length) hash))))
+
+;; Get the contents of a file, or #f if it does not exist.
+(define (file-contents path)
+  (and (file-exists? path)
+       (let ((str (call-with-input-file path
+                    (lambda (port) (read-string #f port)))))
+         (if (eof-object? str) "" str))))
+
+;; Compile the C file at SOURCE into the shared object at OBJECT with the
+;; compiler named by CC, or cc.
+(define (compile-shared-object source object)
+  (let* ((compiler (or (get-environment-variable "CC") "cc"))
+         (status (system (string-append compiler
+                                        " -O2 -shared -fPIC -o "
+                                        (qs object)
+                                        " "
+                                        (qs source)))))
+    (unless (= status 0)
+      (error "jit-compile: C compiler failed" status))))
+
+;; Load the shared object at PATH and get its functions, which read the
+;; variables of SLOTS.
+(define (load-jit-function path slots)
+  (let ((handle (or (%dlopen path dlopen-now)
+                    (error "jit-compile: Cannot load compiled expression"
+                           (%dlerror)))))
+    (define (function name)
+      (or (%dlsym handle name)
+          (error "jit-compile: Missing function in compiled expression"
+                 name
+                 path)))
+    (make-jit-function (function "xpr") (function "xpr_n") slots)))
+
+;; Compile a binary tree to native code and load it. Native code computes
+;; with flonums, as the c fix does, so unlike eval-tree it gives 3.5 for 7 / 2
+;; and an infinity for 1 / 0.
+;;
+;; The C written by the c fix is compiled into a shared object in the cache
+;; directory, named by a hash of the C and its length, so later runs with the
+;; same expression load it without compiling. The C is kept beside it and
+;; compared before the object is reused, so a hash collision recompiles
+;; instead. Both files are written under temporary names and renamed into
+;; place, the C last, so concurrent runs never load a partial object.
+(define (jit-compile tree #!optional pool)
+  (let* ((source (traverse 'c tree pool))
+         (directory (jit-cache-directory))
+         (base (string-append directory
+                              "/xpr-"
+                              (number->string (source-hash source) 16)
+                              "-"
+                              (number->string (string-length source))))
+         (source-path (string-append base ".c"))
+         (object-path (string-append base ".so")))
+    (unless (and (equal? (file-contents source-path) source)
+                 (file-exists? object-path))
+      (let* ((suffix (string-append ".tmp" (number->string (current-process-id))))
+             (temporary-source (string-append base suffix ".c"))
+             (temporary-object (string-append base suffix ".so")))
+        (create-directory directory #t)
+        (call-with-output-file temporary-source
+          (lambda (port) (display source port)))
+        (compile-shared-object temporary-source temporary-object)
+        (rename-file temporary-object object-path #t)
+        (rename-file temporary-source source-path #t)))
+    (load-jit-function object-path
+                       (map variable-slot (tree-variables tree pool)))))
+
+;; Call a natively compiled expression, its variables taking their values
+;; from BINDINGS, an f64vector indexed by variable slot, which must hold the
+;; slot of each.
+(define (jit-call function #!optional (bindings (f64vector)))
+  (unless (f64vector? bindings)
+    (error "jit-call: Bindings are not an f64vector" bindings))
+  (for-each (lambda (slot)
+              (unless (< slot (f64vector-length bindings))
+                (error "jit-call: Missing binding for slot" slot)))
+            (jit-function-slots function))
+  (%jit-call (jit-function-scalar function) bindings))
+
+;; Call a natively compiled expression over COLUMNS, a vector of f64vectors
+;; indexed by variable slot, which must hold a column for the slot of each of
+;; its variables, returning an f64vector of its value for each row.
+(define (jit-call-columns function columns)
+  (for-each (lambda (slot)
+              (unless (and (< slot (vector-length columns))
+                           (f64vector? (vector-ref columns slot)))
+                (error "jit-call-columns: Missing column for slot" slot)))
+            (jit-function-slots function))
+  (let* ((rows (column-rows columns))
+         (out (make-f64vector rows 0.0)))
+    (%jit-call-n (jit-function-array function) rows columns out)
+    out))
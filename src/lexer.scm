@@ -1,34 +1,206 @@
 ;;;; lexer.scm - Mathematical expression lexer.
 
-(declare (unit lexer))
+(declare (unit lexer)
+         (uses operator))
 
-(import (chicken string))
+(import (chicken fixnum)
+        srfi-4)
 
-(define operator-characters '(#\+ #\- #\* #\/ #\( #\)))
+;; Classes of the ASCII characters, indexed by character code: space, digit,
+;; point, letter, other, or the operator code of an operator character.
+;; Letters, which include the underscore, start identifiers.
+(define character-classes
+  (let ((classes (make-vector 128 'other)))
+    (for-each (lambda (char)
+                (vector-set! classes (char->integer char) 'space))
+              '(#\space #\tab #\newline #\return #\page #\vtab))
+    (do ((code 0 (fx+ code 1)))
+        ((fx= code (vector-length operator-characters)))
+      (vector-set! classes (char->integer (operator-code->char code)) code))
+    (do ((code (char->integer #\0) (fx+ code 1)))
+        ((fx> code (char->integer #\9)))
+      (vector-set! classes code 'digit))
+    (do ((code (char->integer #\a) (fx+ code 1)))
+        ((fx> code (char->integer #\z)))
+      (vector-set! classes code 'letter)
+      (vector-set! classes (fx- code 32) 'letter))
+    (vector-set! classes (char->integer #\_) 'letter)
+    (vector-set! classes (char->integer #\.) 'point)
+    classes))
 
-;; Convert a string into a token.
-(define (string->token str)
-  (if (and (= (string-length str) 1)
-           (member (string-ref str 0) operator-characters))
-      (list 'operator (string-ref str 0))
-      (list 'number (string->number str))))
+;; Get the class of a character.
+(define (character-class char)
+  (let ((code (char->integer char)))
+    (if (fx< code 128)
+        (vector-ref character-classes code)
+        'other)))
 
-;; Get the type of a token.
-(define (token-type token)
-  (car token))
+;; Kinds of token, as stored in a token buffer.
+(define token-kind-number 0)
+(define token-kind-operator 1)
+(define token-kind-identifier 2)
 
-;; Get the value of a token.
-(define (token-value token)
-  (cadr token))
+;; A token buffer holds a sequence of tokens as parallel vectors: the kind of
+;; each token, and its value, which is a number, an operator code, or the name
+;; of an identifier.
+(define-record-type token-buffer
+  (%make-token-buffer kinds vals length)
+  token-buffer?
+  (kinds token-buffer-kinds token-buffer-kinds-set!)
+  (vals token-buffer-values token-buffer-values-set!)
+  (length token-buffer-length token-buffer-length-set!))
 
-;; Determine if a token is of the type: operator.
-(define (token-operator? token)
-  (eq? 'operator (token-type token)))
+;; Make an empty token buffer with room for CAPACITY tokens before it must
+;; grow.
+(define (make-token-buffer #!optional (capacity 64))
+  (%make-token-buffer (make-u8vector (max capacity 1) 0)
+                      (make-vector (max capacity 1) #f)
+                      0))
 
-;; Determine if a token is of the type: number.
-(define (token-number? token)
-  (eq? 'number (token-type token)))
+;; Remove every token from a token buffer, keeping its storage.
+(define (token-buffer-clear! tokens)
+  (token-buffer-length-set! tokens 0))
 
-;; Get a list of the tokens contained within an expression string.
-(define (lex-xpr xpr)
-  (map string->token (string-split xpr)))
+;; Append a token of KIND with VALUE to a token buffer.
+(define (token-buffer-push! tokens kind value)
+  (let ((length (token-buffer-length tokens)))
+    (when (fx= length (u8vector-length (token-buffer-kinds tokens)))
+      (let ((kinds (make-u8vector (fx* 2 length) 0))
+            (old-kinds (token-buffer-kinds tokens)))
+        (do ((i 0 (fx+ i 1)))
+            ((fx= i length))
+          (u8vector-set! kinds i (u8vector-ref old-kinds i)))
+        (token-buffer-kinds-set! tokens kinds)
+        (token-buffer-values-set! tokens (vector-resize
+                                          (token-buffer-values tokens)
+                                          (fx* 2 length)
+                                          #f))))
+    (u8vector-set! (token-buffer-kinds tokens) length kind)
+    (vector-set! (token-buffer-values tokens) length value)
+    (token-buffer-length-set! tokens (fx+ length 1))))
+
+;; Get the type of the Ith token: operator, number or identifier.
+(define (token-type tokens i)
+  (cond ((token-operator? tokens i) 'operator)
+        ((token-number? tokens i) 'number)
+        (else 'identifier)))
+
+;; Get the value of the Ith token: a number, the operator's character, or the
+;; identifier's name.
+(define (token-value tokens i)
+  (let ((value (vector-ref (token-buffer-values tokens) i)))
+    (if (token-operator? tokens i)
+        (operator-code->char value)
+        value)))
+
+;; Get the operator code of the Ith token, which must be an operator.
+(define (token-operator-code tokens i)
+  (vector-ref (token-buffer-values tokens) i))
+
+;; Determine if the Ith token is of the type: operator.
+(define (token-operator? tokens i)
+  (fx= token-kind-operator (u8vector-ref (token-buffer-kinds tokens) i)))
+
+;; Determine if the Ith token is of the type: number.
+(define (token-number? tokens i)
+  (fx= token-kind-number (u8vector-ref (token-buffer-kinds tokens) i)))
+
+;; Determine if the Ith token is of the type: identifier.
+(define (token-identifier? tokens i)
+  (fx= token-kind-identifier (u8vector-ref (token-buffer-kinds tokens) i)))
+
+;; Determine if the Ith token is an operand: a number or an identifier.
+(define (token-operand? tokens i)
+  (not (token-operator? tokens i)))
+
+;; Fill a token buffer with the tokens contained within an expression string
+;; and return it. TOKENS is cleared and reused when given.
+(define (lex-xpr xpr #!optional (tokens (make-token-buffer)))
+  (define end (string-length xpr))
+
+  ;; Determine if the character at I is the start of a number.
+  (define (number-start? i)
+    (and (fx< i end)
+         (memq (character-class (string-ref xpr i)) '(digit point))))
+
+  ;; Determine if the minus sign at I negates the number following it rather
+  ;; than being a subtraction, which is when it does not follow an operand.
+  (define (sign? i)
+    (and (number-start? (fx+ i 1))
+         (or (fx= i 0)
+             (let* ((previous (string-ref xpr (fx- i 1)))
+                    (class (character-class previous)))
+               (or (eq? class 'space)
+                   (and (fixnum? class)
+                        (not (char=? previous #\)))))))))
+
+  ;; Get the value of the digits from START up to STOP.
+  (define (digits->integer start stop)
+    (do ((i start (fx+ i 1))
+         (value 0 (+ (* value 10)
+                     (fx- (char->integer (string-ref xpr i))
+                          (char->integer #\0)))))
+        ((fx= i stop) value)))
+
+  ;; Scan the number starting at START, returning its value and the index
+  ;; following it. Numbers made only of digits are accumulated directly,
+  ;; others are read with string->number.
+  (define (scan-number start negative)
+    (let scan ((i start)
+               (integer #t))
+      (let ((class (and (fx< i end) (character-class (string-ref xpr i)))))
+        (cond ((eq? class 'digit)
+               (scan (fx+ i 1) integer))
+              ((eq? class 'point)
+               (scan (fx+ i 1) #f))
+              ((and class (memv (string-ref xpr i) '(#\e #\E)))
+               (scan (if (and (fx< (fx+ i 1) end)
+                              (memv (string-ref xpr (fx+ i 1)) '(#\+ #\-)))
+                         (fx+ i 2)
+                         (fx+ i 1))
+                     #f))
+              ((memq class '(letter other))
+               (error "lex-xpr: Invalid number" (substring xpr start (fx+ i 1))))
+              (else
+               (let ((value (if integer
+                                (digits->integer start i)
+                                (string->number (substring xpr start i)))))
+                 (unless value
+                   (error "lex-xpr: Invalid number" (substring xpr start i)))
+                 (values (if negative (- value) value) i)))))))
+
+  ;; Get the index following the identifier starting at START.
+  (define (identifier-end start)
+    (let scan ((i (fx+ start 1)))
+      (if (and (fx< i end)
+               (memq (character-class (string-ref xpr i)) '(letter digit)))
+          (scan (fx+ i 1))
+          i)))
+
+  (token-buffer-clear! tokens)
+  (let loop ((i 0))
+    (if (fx= i end)
+        tokens
+        (let* ((char (string-ref xpr i))
+               (class (character-class char)))
+          (cond ((eq? class 'space)
+                 (loop (fx+ i 1)))
+                ((and (char=? char #\-) (sign? i))
+                 (let-values (((value next) (scan-number (fx+ i 1) #t)))
+                   (token-buffer-push! tokens token-kind-number value)
+                   (loop next)))
+                ((fixnum? class)
+                 (token-buffer-push! tokens token-kind-operator class)
+                 (loop (fx+ i 1)))
+                ((memq class '(digit point))
+                 (let-values (((value next) (scan-number i #f)))
+                   (token-buffer-push! tokens token-kind-number value)
+                   (loop next)))
+                ((eq? class 'letter)
+                 (let ((next (identifier-end i)))
+                   (token-buffer-push! tokens
+                                       token-kind-identifier
+                                       (substring xpr i next))
+                   (loop next)))
+                (else
+                 (error "lex-xpr: Invalid character" char)))))))
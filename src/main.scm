@@ -1,34 +1,185 @@
 ;;;; main.scm - Main function and REPL.
 
-(declare (uses lexer)
+(declare (uses batch)
+         (uses converter)
          (uses parser)
+         (uses server)
          (uses tree))
 
 (import (chicken format)
-        (chicken process-context))
+        (chicken io)
+        (chicken port)
+        (chicken process-context)
+        (chicken string))
 
 (define (parse-fix-arg arg)
-  (cond ((or (string-ci=? arg "pre")
-             (string-ci=? arg "prefix"))
-         'prefix)
-        ((or (string-ci=? arg "in")
-             (string-ci=? arg "infix"))
-         'infix)
-        ((or (string-ci=? arg "post")
-             (string-ci=? arg "postfix"))
-         'postfix)
-        (else (format #t "xpr-fix: Invalid fix argument: ~A~%" arg)
-              (exit 1))))
+  (or (string->fix arg)
+      (begin (format #t "xpr-fix: Invalid fix argument: ~A~%" arg)
+             (exit 1))))
+
+;; Get the expression given by ARG, reading it from standard input when ARG is
+;; "-".
+(define (parse-expression-arg arg)
+  (if (string=? arg "-")
+      (let ((str (read-string #f (current-input-port))))
+        (if (eof-object? str) "" str))
+      arg))
+
+;; Print the usage of xpr-fix.
+(define (print-usage)
+  (for-each (lambda (line)
+              (display line)
+              (newline))
+            '("Usage: xpr-fix [--fold] [--name NAME]"
+              "               INPUT_FIX OUTPUT_FIX EXPRESSION"
+              "       xpr-fix [--var NAME=VALUE]... --eval|--jit|--engine NAME"
+              "               INPUT_FIX EXPRESSION"
+              "       xpr-fix --batch [--jobs N [--unordered]]"
+              "               INPUT_FIX OUTPUT_FIX [FILE]"
+              "       xpr-fix --server SOCKET"
+              "Engines are tree, closure, bytecode, registers and jit."
+              "See README.org for details.")))
+
+;; Print an error message and the usage of xpr-fix, then exit.
+(define (usage-error message argument)
+  (format #t "xpr-fix: ~A: ~A~%" message argument)
+  (print-usage)
+  (exit 1))
+
+;; Get the name and value of a variable binding given by ARG, which has the
+;; form NAME=VALUE.
+(define (parse-binding-arg arg)
+  (let* ((separator (substring-index "=" arg))
+         (value (and separator
+                     (string->number (substring arg (+ separator 1))))))
+    (unless (and value (> separator 0))
+      (usage-error "Invalid variable binding" arg))
+    (cons (substring arg 0 separator) value)))
+
+;; Get the output fix evaluating expressions with the engine named by ARG.
+(define (parse-engine-arg arg)
+  (cond ((string=? arg "tree") 'value)
+        ((string=? arg "closure") 'closure)
+        ((string=? arg "bytecode") 'bytecode)
+        ((string=? arg "registers") 'registers)
+        ((string=? arg "jit") 'jit)
+        (else (usage-error "Invalid engine" arg))))
 
 (define (main args)
-  (unless (= (length args) 3)
-    (format #t "xpr-fix: Invalid argument count: ~A~%~
-                Usage: xpr-fix INPUT_FIX OUTPUT_FIX EXPRESSION~%"
-            (length args))
-    (exit 1))
-  (format #t "~A~%"
-          (traverse (parse-fix-arg (cadr args))
-                    (parse-xpr (parse-fix-arg (car args))
-                               (lex-xpr (caddr args))))))
+  (define server (and (pair? args) (string=? (car args) "--server")))
+  (define batch #f)
+  (define jobs #f)
+  (define ordered #t)
+  (define evaluate #f)
+  (define engine 'value)
+  (define fold #f)
+  (define name #f)
+  (define bindings '())
+  (let loop ()
+    (when (pair? args)
+      (cond ((string=? (car args) "--batch")
+             (set! batch #t)
+             (set! args (cdr args))
+             (loop))
+            ((string=? (car args) "--jobs")
+             (set! jobs (and (pair? (cdr args))
+                             (string->number (cadr args))))
+             (unless (and (exact-integer? jobs) (> jobs 0))
+               (usage-error "Invalid job count"
+                            (if (pair? (cdr args)) (cadr args) "")))
+             (set! args (cddr args))
+             (loop))
+            ((string=? (car args) "--unordered")
+             (set! ordered #f)
+             (set! args (cdr args))
+             (loop))
+            ((string=? (car args) "--eval")
+             (set! evaluate #t)
+             (set! args (cdr args))
+             (loop))
+            ((string=? (car args) "--jit")
+             (set! evaluate #t)
+             (set! engine 'jit)
+             (set! args (cdr args))
+             (loop))
+            ((string=? (car args) "--engine")
+             (set! evaluate #t)
+             (set! engine (parse-engine-arg (if (pair? (cdr args))
+                                                (cadr args)
+                                                "")))
+             (set! args (cddr args))
+             (loop))
+            ((string=? (car args) "--fold")
+             (set! fold #t)
+             (set! args (cdr args))
+             (loop))
+            ((string=? (car args) "--name")
+             (set! name (if (pair? (cdr args)) (cadr args) ""))
+             (unless (c-identifier? name)
+               (usage-error "Invalid C function name" name))
+             (set! args (cddr args))
+             (loop))
+            ((string=? (car args) "--var")
+             (set! bindings (cons (parse-binding-arg (if (pair? (cdr args))
+                                                         (cadr args)
+                                                         ""))
+                                  bindings))
+             (set! args (cddr args))
+             (loop)))))
+  (when server
+    (unless (= (length args) 2)
+      (usage-error "Invalid argument count" (- (length args) 1)))
+    (serve (cadr args))
+    (exit 0))
+  (let* ((fix-count (if evaluate 1 2))
+         (operand-count (- (length args) fix-count)))
+    (cond ((and (or jobs (not ordered))
+                (not (and batch jobs (= operand-count 1))))
+           (usage-error "Invalid options"
+                        "--jobs and --unordered need --batch and a FILE"))
+          ((not (if batch
+                    (<= 0 operand-count 1)
+                    (= operand-count 1)))
+           (usage-error "Invalid argument count" (length args))))
+    (let ((input-fix (parse-fix-arg (car args)))
+          (output-fix (if evaluate engine (parse-fix-arg (cadr args))))
+          (operands (list-tail args fix-count))
+          (converter (make-converter)))
+      (when (eq? input-fix 'c)
+        (usage-error "Invalid input fix" (car args)))
+      ;; Batch mode writes one line for each line it reads, which C does not
+      ;; fit in.
+      (when (and batch (eq? output-fix 'c))
+        (usage-error "Invalid output fix in batch mode" (cadr args)))
+      (converter-fold-set! converter fold)
+      (when name
+        (converter-c-name-set! converter name))
+      (for-each (lambda (binding)
+                  (converter-bind! converter (car binding) (cdr binding)))
+                (reverse bindings))
+      (set-buffering-mode! (current-output-port) #:full output-buffer-size)
+      (if batch
+          (unless (cond (jobs
+                         (convert-file-parallel converter
+                                                input-fix output-fix
+                                                (car operands)
+                                                jobs ordered))
+                        ((pair? operands)
+                         (call-with-input-file (car operands)
+                           (lambda (port)
+                             (convert-lines converter input-fix output-fix
+                                            port (current-output-port)))))
+                        (else
+                         (convert-lines converter input-fix output-fix
+                                        (current-input-port)
+                                        (current-output-port))))
+            (exit 1))
+          (begin
+            (converter-convert! converter
+                                input-fix
+                                output-fix
+                                (parse-expression-arg (car operands))
+                                (current-output-port))
+            (newline))))))
 
 (main (command-line-arguments))
@@ -0,0 +1,38 @@
+;;;; operator.scm - Mathematical operators.
+
+(declare (unit operator))
+
+;; Operator characters, indexed by operator code.
+(define operator-characters '#(#\+ #\- #\* #\/ #\( #\)))
+
+;; Get the character of an operator code.
+(define (operator-code->char code)
+  (vector-ref operator-characters code))
+
+;; Get the operator code of an operator character.
+(define (char->operator-code char)
+  (case char
+    ((#\+) 0)
+    ((#\-) 1)
+    ((#\*) 2)
+    ((#\/) 3)
+    ((#\() 4)
+    ((#\)) 5)
+    (else (error "char->operator-code: Invalid operator" char))))
+
+;; Determine if a character is a binary operator.
+(define (binary-operator? char)
+  (and (memv char '(#\+ #\- #\* #\/)) #t))
+
+;; Get the precedence of a binary operator, higher values bind tighter.
+(define (operator-precedence operator)
+  (case operator
+    ((#\+ #\-) 1)
+    ((#\* #\/) 2)
+    (else (error "operator-precedence: Invalid operator" operator))))
+
+;; Get the associativity of a binary operator: left or right.
+(define (operator-associativity operator)
+  (if (binary-operator? operator)
+      'left
+      (error "operator-associativity: Invalid operator" operator)))
@@ -0,0 +1,99 @@
+;;;; optimizer.scm - Simplification of parse trees.
+
+(declare (unit optimizer)
+         (uses evaluator)
+         (uses tree))
+
+(import srfi-4)
+
+;; Get the value of a binary operator applied to two constants, or #f when it
+;; is not folded: for division by an exact zero, which is left to raise its
+;; error when evaluated, and for values a number token cannot be written as,
+;; such as fractions and infinities.
+(define (fold-constants operator left right)
+  (and (not (and (char=? operator #\/) (exact? right) (zero? right)))
+       (let ((value (apply-operator operator left right)))
+         (and (or (exact-integer? value)
+                  (and (flonum? value) (finite? value)))
+              value))))
+
+;; Simplify a binary operator node given the values of its children, LEFT and
+;; RIGHT, which are numbers for constants and #f otherwise. Return the number
+;; the node folds to, left or right when it reduces to that child, or #f when
+;; it is kept. Only exact zeros and ones are identities, as inexact ones would
+;; change the results of infinities and NaN.
+;;
+;; An exact zero is an annihilator, making x * 0 and 0 * x zero, only when
+;; ANNIHILATE is true, since removing x drops the errors it can raise and
+;; the NaN it gives when it is infinite. Conversions that fold use it, while
+;; evaluation keeps x.
+(define (simplify-operator operator left right #!optional annihilate)
+  (or (and left right (fold-constants operator left right))
+      (case operator
+        ((#\+) (cond ((eqv? right 0) 'left)
+                     ((eqv? left 0) 'right)
+                     (else #f)))
+        ((#\-) (and (eqv? right 0) 'left))
+        ((#\*) (cond ((and annihilate (or (eqv? left 0) (eqv? right 0))) 0)
+                     ((eqv? right 1) 'left)
+                     ((eqv? left 1) 'right)
+                     (else #f)))
+        ((#\/) (and (eqv? right 1) 'left))
+        (else #f))))
+
+;; Fold the constant subtrees of a binary tree and remove operations by
+;; identities: x + 0, 0 + x, x - 0, x * 1, 1 * x and x / 1 become x, and
+;; x * 0 and 0 * x become 0 when ANNIHILATE is true. Return the simplified
+;; tree, which shares the unchanged subtrees of TREE.
+(define (fold-tree tree #!optional annihilate)
+  (define (constant tree)
+    (and (not (tree-left tree))
+         (number? (tree-root tree))
+         (tree-root tree)))
+  (if (tree-left tree)
+      (let* ((left (fold-tree (tree-left tree) annihilate))
+             (right (fold-tree (tree-right tree) annihilate))
+             (result (simplify-operator (tree-root tree)
+                                        (constant left)
+                                        (constant right)
+                                        annihilate)))
+        (cond ((eq? result 'left) left)
+              ((eq? result 'right) right)
+              (result (make-tree result))
+              ((and (eq? left (tree-left tree))
+                    (eq? right (tree-right tree)))
+               tree)
+              (else (make-tree (tree-root tree) left right))))
+      tree))
+
+;; Simplify the tree at node ROOT of a node pool as fold-tree does, and return
+;; the index of the simplified tree's root node. Changed nodes are added to
+;; the pool, and unchanged subtrees are shared. Nodes are simplified once each
+;; in index order, which puts them after their children, so a node with
+;; several parents in a shared pool is not simplified again for each.
+(define (fold-pool! pool root #!optional annihilate)
+  (let ((folded (make-s32vector (+ root 1) -1)))
+    (define (constant node)
+      (and (not (node-pool-left pool node))
+           (number? (node-pool-root pool node))
+           (node-pool-root pool node)))
+    (do ((node 0 (+ node 1)))
+        ((> node root) (s32vector-ref folded root))
+      (let ((old-left (node-pool-left pool node)))
+        (s32vector-set!
+         folded node
+         (if old-left
+             (let* ((old-right (node-pool-right pool node))
+                    (left (s32vector-ref folded old-left))
+                    (right (s32vector-ref folded old-right))
+                    (operator (node-pool-root pool node))
+                    (result (simplify-operator operator
+                                               (constant left)
+                                               (constant right)
+                                               annihilate)))
+               (cond ((eq? result 'left) left)
+                     ((eq? result 'right) right)
+                     (result (node-pool-add! pool result))
+                     ((and (= left old-left) (= right old-right)) node)
+                     (else (node-pool-add! pool operator left right))))
+             node))))))
@@ -1,61 +1,165 @@
 ;;;; parser.scm - Mathematical expression parser.
 
 (declare (unit parser)
+         (uses lexer)
+         (uses operator)
          (uses stack)
+         (uses symbols)
          (uses tree))
 
-;; Convert a list of tokens into a parse tree.
-(define (parse-xpr fix tokens)
+;; Get the fix named by a string: prefix, infix, postfix, c, or #f if the
+;; string names none of them. The c fix is only an output fix.
+(define (string->fix str)
+  (cond ((or (string-ci=? str "pre")
+             (string-ci=? str "prefix"))
+         'prefix)
+        ((or (string-ci=? str "in")
+             (string-ci=? str "infix"))
+         'infix)
+        ((or (string-ci=? str "post")
+             (string-ci=? str "postfix"))
+         'postfix)
+        ((string-ci=? str "c")
+         'c)
+        (else #f)))
+
+;; Convert a token buffer into a parse tree. When POOL is given, the tree's
+;; nodes are added to it, equal subtrees sharing a node when it is shared, and
+;; the index of its root node is returned. The stacks OPERAND-STACK and
+;; OPERATOR-STACK are cleared and used for parsing when given, instead of new
+;; ones. Identifiers become variables interned in SYMBOLS, or in a new symbol
+;; table when it is not given.
+(define (parse-xpr fix tokens
+                   #!optional pool operand-stack operator-stack symbols)
+  (define count (token-buffer-length tokens))
+  (define make-node
+    (if pool
+        (lambda (root #!optional left right)
+          (node-pool-add! pool root left right))
+        make-tree))
+  (define table (or symbols (make-symbol-table)))
+
+  ;; Make the leaf node for the operand token at I.
+  (define (make-leaf i)
+    (make-node (if (token-identifier? tokens i)
+                   (symbol-table-intern! table (token-value tokens i))
+                   (token-value tokens i))))
+
   (define (prefix tokens)
-    (make-tree (let ((token (car tokens)))
-                 (set! (car tokens) #f)
-                 (token-value token))
-               (if (token-operator? (cadr tokens))
-                   (prefix (cdr tokens))
-                   (let ((token (cadr tokens)))
-                     (set! (cadr tokens) #f)
-                     (make-tree (token-value token))))
-               (let loop ((i 2))
-                 (if (list-ref tokens i)
-                     (if (token-operator? (list-ref tokens i))
-                         (prefix (list-tail tokens i))
-                         (let ((token (list-ref tokens i)))
-                           (set! (list-ref tokens i) #f)
-                           (make-tree (token-value token))))
-                     (loop (+ i 1))))))
-
-  ;;(define (infix tokens)
-  ;;  )
+    (define cursor 0)
+    (define (next-token!)
+      (if (= cursor count)
+          (error "parse-xpr: prefix: Invalid expression")
+          (let ((i cursor))
+            (set! cursor (+ cursor 1))
+            i)))
+    (define (parse)
+      (let ((i (next-token!)))
+        (cond ((token-operand? tokens i)
+               (make-leaf i))
+              ((binary-operator? (token-value tokens i))
+               (let* ((left-tree (parse))
+                      (right-tree (parse)))
+                 (make-node (token-value tokens i) left-tree right-tree)))
+              (else
+               (error "parse-xpr: prefix: Invalid expression")))))
+    (let ((tree (parse)))
+      (if (= cursor count)
+          tree
+          (error "parse-xpr: prefix: Invalid expression"))))
+
+  (define (infix tokens)
+    (define operands
+      (if operand-stack (stack-clear! operand-stack) (make-stack '())))
+    (define operators
+      (if operator-stack (stack-clear! operator-stack) (make-stack '())))
+    (define (invalid)
+      (error "parse-xpr: infix: Invalid expression"))
+    (define (pop-operand!)
+      (if (stack-empty? operands)
+          (invalid)
+          (let ((tree (stack-top operands)))
+            (stack-pop operands)
+            tree)))
+    ;; Apply the top operator to the top two operands.
+    (define (reduce!)
+      (let* ((operator (stack-top operators))
+             (right-tree (pop-operand!))
+             (left-tree (pop-operand!)))
+        (stack-pop operators)
+        (stack-push operands (make-node operator left-tree right-tree))))
+    ;; Determine if the top operator must be applied before OPERATOR.
+    (define (reduce-before? operator)
+      (and (not (stack-empty? operators))
+           (binary-operator? (stack-top operators))
+           (let ((top-precedence (operator-precedence (stack-top operators)))
+                 (precedence (operator-precedence operator)))
+             (or (> top-precedence precedence)
+                 (and (= top-precedence precedence)
+                      (eq? (operator-associativity operator) 'left))))))
+    (let loop ((i 0)
+               (expect-operand #t))
+      (if (= i count)
+          (begin
+            (when expect-operand (invalid))
+            (let finish ()
+              (unless (stack-empty? operators)
+                (when (eqv? (stack-top operators) #\() (invalid))
+                (reduce!)
+                (finish)))
+            (let ((tree (pop-operand!)))
+              (if (stack-empty? operands)
+                  tree
+                  (invalid))))
+          (let ((value (token-value tokens i)))
+            (cond ((token-operand? tokens i)
+                   (unless expect-operand (invalid))
+                   (stack-push operands (make-leaf i))
+                   (loop (+ i 1) #f))
+                  ((eqv? value #\()
+                   (unless expect-operand (invalid))
+                   (stack-push operators value)
+                   (loop (+ i 1) #t))
+                  ((eqv? value #\))
+                   (when expect-operand (invalid))
+                   (let close ()
+                     (cond ((stack-empty? operators) (invalid))
+                           ((eqv? (stack-top operators) #\()
+                            (stack-pop operators))
+                           (else (reduce!)
+                                 (close))))
+                   (loop (+ i 1) #f))
+                  (else
+                   (when expect-operand (invalid))
+                   (let reduce ()
+                     (when (reduce-before? value)
+                       (reduce!)
+                       (reduce)))
+                   (stack-push operators value)
+                   (loop (+ i 1) #t)))))))
 
   (define (postfix tokens)
-    (define stack (make-stack '()))
-    (let loop ((tokens tokens))
-      (unless (null? tokens)
-        (let ((token (car tokens)))
-          (if (token-operator? token)
-              (let* ((left-element (stack-top-n stack 1))
-                     (right-element (stack-top-n stack 0))
-                     (left-tree (if (tree? left-element)
-                                    left-element
-                                    (make-tree left-element)))
-                     (right-tree (if (tree? right-element)
-                                     right-element
-                                     (make-tree right-element))))
-                (set! stack (stack-pop-n stack 2))
-                (set! stack (stack-push stack
-                                        (make-tree (token-value token)
-                                                   left-tree right-tree))))
-              (set! stack (stack-push stack (token-value token)))))
-        (loop (cdr tokens))))
-    (if (and (= (stack-length stack) 1)
-             (tree? (stack-top stack)))
+    (define stack
+      (if operand-stack (stack-clear! operand-stack) (make-stack '() count)))
+    (do ((i 0 (+ i 1)))
+        ((= i count))
+      (if (token-operator? tokens i)
+          (if (or (< (stack-length stack) 2)
+                  (not (binary-operator? (token-value tokens i))))
+              (error "parse-xpr: postfix: Invalid expression")
+              (let ((left-tree (stack-top-n stack 1))
+                    (right-tree (stack-top-n stack 0)))
+                (stack-pop-n stack 2)
+                (stack-push stack (make-node (token-value tokens i)
+                                             left-tree
+                                             right-tree))))
+          (stack-push stack (make-leaf i))))
+    (if (= (stack-length stack) 1)
         (stack-top stack)
         (error "parse-xpr: postfix: Invalid expression")))
 
-  (if (and (= (length tokens) 1)
-           (eq? (token-type (car tokens)) 'number))
-      (make-tree (token-value (car tokens)))
-      (case fix
-        ((prefix) (prefix tokens))
-        ;;((infix) (infix tokens))
-        ((postfix) (postfix tokens)))))
+  (case fix
+    ((prefix) (prefix tokens))
+    ((infix) (infix tokens))
+    ((postfix) (postfix tokens))
+    (else (error "parse-xpr: Invalid input fix" fix))))
@@ -0,0 +1,172 @@
+;;;; registers.scm - Register machine code for expressions.
+
+(declare (unit registers)
+         (uses bytecode)
+         (uses operator)
+         (uses symbols)
+         (uses tree))
+
+(import (chicken fixnum)
+        srfi-4)
+
+;; A register program is a sequence of instructions over registers that are
+;; the slots of one f64vector, allocated once at the size the program needs.
+;; Each instruction takes four words of its code: its opcode, which is one of
+;; the bytecode opcodes, its destination register, and two operands. Constant
+;; instructions load the constant whose index is their first operand,
+;; variable instructions load the binding of the variable whose slot is their
+;; first operand, and operator instructions combine the registers that are
+;; their operands. The result is left in register 0.
+(define-record-type register-program
+  (%make-register-program code constants registers)
+  register-program?
+  (code register-program-code)
+  (constants register-program-constants)
+  (registers register-program-registers))
+
+;; Compile a binary tree into a register program.
+;;
+;; Registers are allocated by Sethi-Ullman numbering: a node needs as many
+;; registers as the child needing more when its children differ, and one more
+;; when they are the same. The child needing more is computed first, so the
+;; program uses the fewest registers an evaluation of the tree can.
+;;
+;; In a shared pool, a node with several parents is computed once, before the
+;; tree, into a register of its own that follows those Sethi-Ullman numbering
+;; uses. Its parents read that register, and need no registers for it.
+(define (compile-registers tree #!optional pool)
+  ;; Number of parents of each node of a shared pool.
+  (define parents (node-pool-parents pool tree))
+  ;; Registers holding the values of shared nodes, by node index.
+  (define shared-registers (and parents (make-vector (fx+ tree 1) #f)))
+
+  (define constant-count 0)
+  (define instruction-count 0)
+
+  (define (shared? node)
+    (and parents (fx> (s32vector-ref parents node) 1)))
+
+  ;; Label a node with the registers it needs, returning a vector of the
+  ;; count, the node, and the labels of its children, or #f for a leaf. A
+  ;; shared node is labelled as needing no registers.
+  (define (label node)
+    (if (shared? node)
+        (vector 0 node #f #f)
+        (label-value node)))
+
+  ;; Label the computation of a node's value, counting its instruction and
+  ;; its constant, if it is one.
+  (define (label-value node)
+    (set! instruction-count (fx+ instruction-count 1))
+    (if (node-left pool node)
+        (let* ((left (label (node-left pool node)))
+               (right (label (node-right pool node)))
+               (left-need (vector-ref left 0))
+               (right-need (vector-ref right 0)))
+          (vector (if (fx= left-need right-need)
+                      (fx+ left-need 1)
+                      (fxmax left-need right-need))
+                  node
+                  left
+                  right))
+        (begin
+          (unless (variable? (node-root pool node))
+            (set! constant-count (fx+ constant-count 1)))
+          (vector 1 node #f #f))))
+
+  (let* ((shared-labels (if parents
+                            (do ((node tree (fx- node 1))
+                                 (labels '()
+                                         (if (shared? node)
+                                             (cons (label-value node) labels)
+                                             labels)))
+                                ((fx< node 0) labels))
+                            '()))
+         (labels (label tree))
+         (stack-size (foldl (lambda (size labels)
+                              (fxmax size (vector-ref labels 0)))
+                            (vector-ref labels 0)
+                            shared-labels))
+         (code (make-u32vector (fx* 4 instruction-count) 0))
+         (constants (make-f64vector constant-count 0.0))
+         (pc 0)
+         (constant 0))
+    (define (emit! opcode destination left right)
+      (u32vector-set! code pc opcode)
+      (u32vector-set! code (fx+ pc 1) destination)
+      (u32vector-set! code (fx+ pc 2) left)
+      (u32vector-set! code (fx+ pc 3) right)
+      (set! pc (fx+ pc 4)))
+    ;; Get the register holding the value of a labelled operand, emitting
+    ;; the instructions computing it into register BASE unless it is shared.
+    (define (operand! labels base)
+      (if (fx= (vector-ref labels 0) 0)
+          (vector-ref shared-registers (vector-ref labels 1))
+          (begin (generate! labels base base)
+                 base)))
+    ;; Emit the instructions computing a labelled node into register
+    ;; DESTINATION, using only registers from BASE on for its operands.
+    (define (generate! labels base destination)
+      (let ((root (node-root pool (vector-ref labels 1)))
+            (left (vector-ref labels 2))
+            (right (vector-ref labels 3)))
+        (cond ((not left)
+               (if (variable? root)
+                   (emit! opcode-variable destination (variable-slot root) 0)
+                   (begin
+                     (f64vector-set! constants constant (exact->inexact root))
+                     (emit! opcode-constant destination constant 0)
+                     (set! constant (fx+ constant 1)))))
+              ((fx>= (vector-ref left 0) (vector-ref right 0))
+               (let* ((left (operand! left base))
+                      (right (operand! right (fx+ base 1))))
+                 (emit! (fx+ (char->operator-code root) 1)
+                        destination left right)))
+              (else
+               (let* ((right (operand! right base))
+                      (left (operand! left (fx+ base 1))))
+                 (emit! (fx+ (char->operator-code root) 1)
+                        destination left right))))))
+    (let loop ((shared-labels shared-labels)
+               (register stack-size))
+      (when (pair? shared-labels)
+        (let ((labels (car shared-labels)))
+          (generate! labels 0 register)
+          (vector-set! shared-registers (vector-ref labels 1) register)
+          (loop (cdr shared-labels) (fx+ register 1)))))
+    (generate! labels 0 0)
+    (%make-register-program code
+                            constants
+                            (make-f64vector (fx+ stack-size
+                                                 (length shared-labels))
+                                            0.0))))
+
+;; Run a register program, leaving the value it computes in register 0, its
+;; variables taking their values from BINDINGS, an f64vector indexed by
+;; variable slot. Values are only moved and combined by the C helpers of the
+;; bytecode unit, so no flonum is boxed and a run allocates nothing. Division
+;; by zero follows IEEE 754.
+(define (run-registers! program #!optional bindings)
+  (let* ((code (register-program-code program))
+         (constants (register-program-constants program))
+         (registers (register-program-registers program))
+         (end (u32vector-length code)))
+    (let loop ((pc 0))
+      (unless (fx= pc end)
+        (let ((opcode (u32vector-ref code pc))
+              (destination (u32vector-ref code (fx+ pc 1)))
+              (left (u32vector-ref code (fx+ pc 2)))
+              (right (u32vector-ref code (fx+ pc 3))))
+          (cond ((fx= opcode opcode-constant)
+                 (%move-value! registers destination constants left))
+                ((fx= opcode opcode-variable)
+                 (%move-value! registers destination bindings left))
+                (else
+                 (%operate! opcode registers destination left right)))
+          (loop (fx+ pc 4)))))))
+
+;; Run a register program and return the value it computes, as
+;; run-registers! does.
+(define (run-registers program #!optional bindings)
+  (run-registers! program bindings)
+  (f64vector-ref (register-program-registers program) 0))
@@ -0,0 +1,194 @@
+;;;; server.scm - Conversion server on a Unix domain socket.
+
+(declare (unit server)
+         (uses batch)
+         (uses converter)
+         (uses parser))
+
+(import (chicken condition)
+        (chicken file posix)
+        (chicken foreign)
+        (chicken format)
+        (chicken io)
+        (chicken port)
+        (chicken process)
+        (chicken string))
+
+(foreign-declare "
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Listen on a Unix domain socket at PATH, replacing a socket left there by
+   an earlier server, and return the socket's descriptor, or -1 on failure.
+   Any other file at PATH is kept, and binding to it fails. */
+static int xpr_unix_listen(const char *path, int backlog)
+{
+    struct sockaddr_un address;
+    struct stat status;
+    int fd;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if (lstat(path, &status) == 0 && S_ISSOCK(status.st_mode))
+        unlink(path);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0
+        || listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Accept a connection on the listening socket FD, and return its descriptor,
+   or the negated errno value on failure. */
+static int xpr_unix_accept(int fd)
+{
+    int connection = accept(fd, NULL, NULL);
+
+    return connection < 0 ? -errno : connection;
+}
+
+/* Determine if ERROR, an errno value accept failed with, may pass once the
+   server has waited: a connection aborted before it was accepted, or a lack
+   of descriptors or memory. */
+static int xpr_accept_transient(int error)
+{
+    switch (error) {
+    case ECONNABORTED:
+    case EMFILE:
+    case ENFILE:
+    case ENOBUFS:
+    case ENOMEM:
+    case EPROTO:
+        return 1;
+    default:
+        return 0;
+    }
+}
+")
+
+;; Listen on a Unix domain socket, returning its descriptor or -1.
+(define unix-listen
+  (foreign-lambda int "xpr_unix_listen" c-string int))
+
+;; Accept a connection on a listening socket, returning its descriptor or the
+;; negated errno value of the failure.
+(define unix-accept
+  (foreign-lambda int "xpr_unix_accept" int))
+
+(define accept-interrupted (foreign-value "EINTR" int))
+
+(define accept-transient?
+  (foreign-lambda bool "xpr_accept_transient" int))
+
+(define error-message
+  (foreign-lambda c-string "strerror" int))
+
+;; Seconds the server waits before accepting again after a transient failure.
+(define accept-backoff 1)
+
+;; Number of pending connections the listening socket queues.
+(define server-backlog 128)
+
+;; Split a request line into its input fix, output fix and expression. The c
+;; fix is refused, since its output would span several response lines.
+(define (parse-request line)
+  (let* ((first-space (or (substring-index " " line)
+                          (error "serve: Invalid request" line)))
+         (second-space (or (substring-index " " line (+ first-space 1))
+                           (error "serve: Invalid request" line)))
+         (input-fix (string->fix (substring line 0 first-space)))
+         (output-fix (string->fix (substring line
+                                             (+ first-space 1)
+                                             second-space))))
+    (unless (and input-fix output-fix
+                 (not (eq? input-fix 'c))
+                 (not (eq? output-fix 'c)))
+      (error "serve: Invalid fix in request" line))
+    (values input-fix output-fix (substring line (+ second-space 1)))))
+
+;; Answer each request read from IN with one line written to OUT, until IN
+;; reaches its end. An invalid request is answered with an error record giving
+;; the reason it is invalid. As in convert-lines, a single handler around the
+;; loop resumes it after an invalid request. Responses are buffered while
+;; more requests are ready, so pipelined requests are answered in few writes.
+(define (serve-connection in out)
+  (let ((converter (make-converter)))
+    (define (serve-remaining-requests)
+      (let loop ()
+        (unless (char-ready? in)
+          (flush-output out))
+        (let ((line (read-line in)))
+          (unless (eof-object? line)
+            (let-values (((input-fix output-fix xpr) (parse-request line)))
+              (converter-convert! converter input-fix output-fix xpr out)
+              (newline out)
+              (loop))))))
+    (let resume ()
+      (when (handle-exceptions condition
+                (if ((condition-predicate 'i/o) condition)
+                    (abort condition)
+                    (begin
+                      (format out "error: ~A~%" (condition-reason condition))
+                      #t))
+              (serve-remaining-requests)
+              #f)
+        (resume)))
+    (flush-output out)))
+
+;; Reap the connection processes that have exited out of COUNT running ones,
+;; and return the number still running.
+(define (reap-connections count)
+  (if (= count 0)
+      0
+      (let-values (((pid normal status) (process-wait -1 #t)))
+        (if (= pid 0)
+            count
+            (reap-connections (- count 1))))))
+
+;; Listen on a Unix domain socket at PATH and serve conversion requests on
+;; each connection accepted. Each connection is served by a process forked
+;; from the server, so it starts with the server's warm heap, and several
+;; clients can be served at once. Accepting is retried at once when a signal
+;; interrupts it, and after a pause, once reported, when it fails for want of
+;; resources.
+(define (serve path)
+  (let ((listener (unix-listen path server-backlog)))
+    (when (< listener 0)
+      (error "serve: Cannot listen on socket" path))
+    (let loop ((connections 0))
+      (let ((fd (unix-accept listener)))
+        (cond
+         ((= fd (- accept-interrupted))
+          (loop (reap-connections connections)))
+         ((and (< fd 0) (accept-transient? (- fd)))
+          (format (current-error-port)
+                  "xpr-fix: Cannot accept connection: ~A~%"
+                  (error-message (- fd)))
+          (process-sleep accept-backoff)
+          (loop (reap-connections connections)))
+         ((< fd 0)
+          (error "serve: Cannot accept connection" (error-message (- fd))))
+         (else
+          (process-fork
+           (lambda ()
+             (file-close listener)
+             (let ((in (open-input-file* fd))
+                   (out (open-output-file* (duplicate-fileno fd))))
+               (set-buffering-mode! out #:full output-buffer-size)
+               (serve-connection in out)
+               (close-output-port out)
+               (close-input-port in))
+             (exit 0)))
+          (file-close fd)
+          (loop (reap-connections (+ connections 1)))))))))
@@ -2,42 +2,74 @@
 
 (declare (unit stack))
 
-;; Make a stack containing ELEMENTS.
-(define (make-stack elements)
+;; A stack is a vector of elements, the bottom element being at index zero,
+;; together with the number of elements in use.
+(define-record-type stack
+  (%make-stack elements length)
+  stack?
+  (elements stack-elements stack-elements-set!)
+  (length stack-length stack-length-set!))
+
+;; Make a stack containing ELEMENTS, the first of which is the top element,
+;; with room for at least CAPACITY elements before it must grow.
+(define (make-stack elements #!optional (capacity 16))
   (if (list? elements)
-      elements
+      (let* ((length (length elements))
+             (vector (make-vector (max capacity length 1) #f)))
+        (let loop ((elements elements)
+                   (i (- length 1)))
+          (unless (null? elements)
+            (vector-set! vector i (car elements))
+            (loop (cdr elements) (- i 1))))
+        (%make-stack vector length))
       (error "make-stack: Bad argument type: ELEMENTS must be a list")))
 
 ;; Check if a stack is empty.
-(define stack-empty? null?)
-
-;; Get the length of a stack.
-(define stack-length length)
+(define (stack-empty? stack)
+  (= (stack-length stack) 0))
 
 ;; Push ELEMENT onto STACK and return STACK.
 (define (stack-push stack element)
-  (cons element stack))
+  (let ((elements (stack-elements stack))
+        (length (stack-length stack)))
+    (when (= length (vector-length elements))
+      (set! elements (vector-resize elements (* 2 length) #f))
+      (stack-elements-set! stack elements))
+    (vector-set! elements length element)
+    (stack-length-set! stack (+ length 1))
+    stack))
 
 ;; Pop an element from STACK and return STACK.
 (define (stack-pop stack)
   (if (stack-empty? stack)
       (error "stack-pop: STACK is empty")
-      (cdr stack)))
+      (stack-pop-n stack 1)))
 
 ;; Pop N elements from STACK and return STACK.
 (define (stack-pop-n stack n)
-  (if (> n (stack-length stack))
-      (error "stack-pop-n: STACK contains less than N elements")
-      (list-tail stack n)))
+  (let ((elements (stack-elements stack))
+        (length (stack-length stack)))
+    (if (> n length)
+        (error "stack-pop-n: STACK contains less than N elements")
+        (let loop ((i (- length n)))
+          (if (< i length)
+              (begin (vector-set! elements i #f)
+                     (loop (+ i 1)))
+              (begin (stack-length-set! stack (- length n))
+                     stack))))))
+
+;; Pop every element from STACK and return STACK, keeping its storage.
+(define (stack-clear! stack)
+  (stack-pop-n stack (stack-length stack)))
 
 ;; Return the top element of STACK.
 (define (stack-top stack)
   (if (stack-empty? stack)
       (error "stack-top: STACK is empty")
-      (car stack)))
+      (vector-ref (stack-elements stack) (- (stack-length stack) 1))))
 
 ;; Return the Nth element from the top of the stack.
 (define (stack-top-n stack n)
   (if (< n (stack-length stack))
-      (list-ref stack n)
+      (vector-ref (stack-elements stack) (- (stack-length stack) n 1))
       (error "stack-top-n: STACK contains less than N+1 elements")))
@@ -0,0 +1,117 @@
+;;;; symbols.scm - Variables and symbol tables.
+
+(declare (unit symbols))
+
+(import (chicken fixnum))
+
+;; A variable of an expression: its name, and the slot holding its value in
+;; the bindings its expression is evaluated with.
+(define-record-type variable
+  (make-variable name slot)
+  variable?
+  (name variable-name)
+  (slot variable-slot))
+
+;; A symbol table interns variable names, giving each distinct name a dense
+;; slot index in the order the names are first seen. It is an open addressing
+;; hash table of variables keyed by name, along with a vector of the variables
+;; indexed by slot.
+(define-record-type symbol-table
+  (%make-symbol-table buckets variables count)
+  symbol-table?
+  (buckets symbol-table-buckets symbol-table-buckets-set!)
+  (variables symbol-table-variables symbol-table-variables-set!)
+  (count symbol-table-size symbol-table-size-set!))
+
+;; Make an empty symbol table with room for CAPACITY variables before it must
+;; grow.
+(define (make-symbol-table #!optional (capacity 16))
+  (let ((capacity (max capacity 1)))
+    (%make-symbol-table (make-vector (* 2 capacity) #f)
+                        (make-vector capacity #f)
+                        0)))
+
+;; Hash a variable name.
+(define (name-hash name)
+  (let ((length (string-length name)))
+    (do ((i 0 (fx+ i 1))
+         (hash 0 (fxand (fx+ (fx* hash 31) (char->integer (string-ref name i)))
+                        #xffffff)))
+        ((fx= i length) hash))))
+
+;; Get the index of the bucket of BUCKETS holding the variable named NAME, or
+;; of the empty bucket where it belongs.
+(define (bucket-index buckets name)
+  (let ((size (vector-length buckets)))
+    (let probe ((i (fxmod (name-hash name) size)))
+      (let ((variable (vector-ref buckets i)))
+        (if (or (not variable)
+                (string=? (variable-name variable) name))
+            i
+            (probe (if (fx= (fx+ i 1) size) 0 (fx+ i 1))))))))
+
+;; Get the variable named NAME in a symbol table, or #f if there is none.
+(define (symbol-table-lookup table name)
+  (let ((buckets (symbol-table-buckets table)))
+    (vector-ref buckets (bucket-index buckets name))))
+
+;; Get the variable named NAME in a symbol table, adding it with the next slot
+;; if there is none.
+(define (symbol-table-intern! table name)
+  (or (symbol-table-lookup table name)
+      (let* ((slot (symbol-table-size table))
+             (variable (make-variable name slot)))
+        (when (fx= slot (vector-length (symbol-table-variables table)))
+          (symbol-table-grow! table))
+        (let ((buckets (symbol-table-buckets table)))
+          (vector-set! buckets (bucket-index buckets name) variable))
+        (vector-set! (symbol-table-variables table) slot variable)
+        (symbol-table-size-set! table (fx+ slot 1))
+        variable)))
+
+;; Remove the variables of a symbol table from slot SIZE on, keeping those
+;; before it. Only the buckets of the table's variables are visited, so the
+;; time taken does not depend on the largest size the table has had.
+(define (symbol-table-truncate! table size)
+  (let ((count (symbol-table-size table))
+        (buckets (symbol-table-buckets table))
+        (variables (symbol-table-variables table)))
+    (when (fx< size count)
+      (let ((indexes (do ((slot 0 (fx+ slot 1))
+                          (indexes '()
+                                   (cons (bucket-index
+                                          buckets
+                                          (variable-name
+                                           (vector-ref variables slot)))
+                                         indexes)))
+                         ((fx= slot count) indexes))))
+        (for-each (lambda (i) (vector-set! buckets i #f)) indexes))
+      (do ((slot 0 (fx+ slot 1)))
+          ((fx= slot count))
+        (if (fx< slot size)
+            (let ((variable (vector-ref variables slot)))
+              (vector-set! buckets
+                           (bucket-index buckets (variable-name variable))
+                           variable))
+            (vector-set! variables slot #f)))
+      (symbol-table-size-set! table size))))
+
+;; Double the capacity of a symbol table, rehashing its variables.
+(define (symbol-table-grow! table)
+  (let* ((count (symbol-table-size table))
+         (variables (vector-resize (symbol-table-variables table)
+                                   (fx* 2 count)
+                                   #f))
+         (buckets (make-vector (fx* 4 count) #f)))
+    (do ((slot 0 (fx+ slot 1)))
+        ((fx= slot count))
+      (let ((variable (vector-ref variables slot)))
+        (vector-set! buckets
+                     (bucket-index buckets (variable-name variable))
+                     variable)))
+    (symbol-table-variables-set! table variables)
+    (symbol-table-buckets-set! table buckets)))
+
+;; Get the variable of a symbol table given slot SLOT.
+(define (symbol-table-ref table slot)
+  (vector-ref (symbol-table-variables table) slot))
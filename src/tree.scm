@@ -1,9 +1,28 @@
 ;;;; tree.scm - Binary tree data type.
 
-(declare (unit tree))
+(declare (unit tree)
+         (uses operator)
+         (uses symbols))
 
-(import (chicken format)
-        (chicken port))
+(import (chicken fixnum)
+        (chicken foreign)
+        (chicken port)
+        (chicken string)
+        srfi-4)
+
+(foreign-declare "
+#include <string.h>
+
+static int xpr_flonum_hash(double x)
+{
+    unsigned long long bits;
+
+    memcpy(&bits, &x, sizeof bits);
+    return (int)((bits ^ (bits >> 29)) & 0xffffff);
+}
+")
+
+(define %flonum-hash (foreign-lambda int "xpr_flonum_hash" double))
 
 (define-record-type tree
   (%make-tree root left right)
@@ -15,31 +34,419 @@
 (define (make-tree #!optional root left right)
   (%make-tree root left right))
 
-;; Get the string representation of a traversal of a binary tree.
-(define (traverse fix tree)
+;; A node pool stores trees in parallel vectors instead of one record per
+;; node: the root value of each node, and the indexes of its left and right
+;; child nodes, which are -1 when absent. A node is always added after its
+;; children, so its index is greater than theirs.
+;;
+;; A shared node pool also hash-conses its nodes: adding a node equal to one
+;; it holds, having the same root value and child indexes, gives the index of
+;; that node instead, so equal subtrees are stored once and a tree becomes a
+;; directed acyclic graph. Its buckets are an open addressing hash table of
+;; node indexes, and are #f in a pool that is not shared.
+;;
+;; Procedures on binary trees take either a tree record, or, when they are
+;; also given a node pool POOL, the index of the tree's root node within it.
+(define-record-type node-pool
+  (%make-node-pool roots lefts rights length buckets)
+  node-pool?
+  (roots node-pool-roots node-pool-roots-set!)
+  (lefts node-pool-lefts node-pool-lefts-set!)
+  (rights node-pool-rights node-pool-rights-set!)
+  (length node-pool-length node-pool-length-set!)
+  (buckets node-pool-buckets node-pool-buckets-set!))
+
+;; Make an empty node pool with room for CAPACITY nodes before it must grow,
+;; which hash-conses its nodes when SHARED is true.
+(define (make-node-pool #!optional (capacity 64) shared)
+  (let ((capacity (max capacity 1)))
+    (%make-node-pool (make-vector capacity #f)
+                     (make-s32vector capacity -1)
+                     (make-s32vector capacity -1)
+                     0
+                     (and shared (make-vector (fx* 2 capacity) #f)))))
+
+;; Determine if a node pool hash-conses its nodes.
+(define (node-pool-shared? pool)
+  (and (node-pool-buckets pool) #t))
+
+;; Remove every node from a node pool, keeping its storage. Only the buckets
+;; of a shared pool's nodes are cleared, so that clearing a pool takes time
+;; proportional to its length rather than to the most nodes it has held. They
+;; are cleared in the reverse of the order the nodes were added, so that the
+;; buckets probed for each node hold just what they did when it was added.
+(define (node-pool-clear! pool)
+  (let ((buckets (node-pool-buckets pool)))
+    (when buckets
+      (do ((node (fx- (node-pool-length pool) 1) (fx- node 1)))
+          ((fx< node 0))
+        (vector-set! buckets
+                     (node-bucket-index pool
+                                        buckets
+                                        (node-pool-root pool node)
+                                        (node-pool-left pool node)
+                                        (node-pool-right pool node))
+                     #f))))
+  (node-pool-length-set! pool 0))
+
+;; Double the storage of a node pool.
+(define (node-pool-grow! pool)
+  (define (grow old)
+    (let* ((length (s32vector-length old))
+           (new (make-s32vector (fx* 2 length) -1)))
+      (do ((i 0 (fx+ i 1)))
+          ((fx= i length) new)
+        (s32vector-set! new i (s32vector-ref old i)))))
+  (let ((length (node-pool-length pool)))
+    (node-pool-roots-set! pool (vector-resize (node-pool-roots pool)
+                                              (fx* 2 length)
+                                              #f))
+    (node-pool-lefts-set! pool (grow (node-pool-lefts pool)))
+    (node-pool-rights-set! pool (grow (node-pool-rights pool)))))
+
+;; Append a node with ROOT and the child nodes LEFT and RIGHT to a node pool
+;; and return its index.
+(define (node-pool-append! pool root left right)
+  (let ((i (node-pool-length pool)))
+    (when (fx= i (vector-length (node-pool-roots pool)))
+      (node-pool-grow! pool))
+    (vector-set! (node-pool-roots pool) i root)
+    (s32vector-set! (node-pool-lefts pool) i (or left -1))
+    (s32vector-set! (node-pool-rights pool) i (or right -1))
+    (node-pool-length-set! pool (fx+ i 1))
+    i))
+
+;; Hash a node given its root value and the indexes of its children, which
+;; are #f for a leaf. Flonums are hashed by their bits, so that hashing does
+;; not allocate for any leaf but a bignum.
+(define (node-hash root left right)
+  (fxand (if left
+             (fx+ (fx* (fx+ (fx* (char->integer root) 31) left) 31) right)
+             (cond ((variable? root) (fx+ (variable-slot root) 1))
+                   ((fixnum? root) (fx* root 17))
+                   ((flonum? root) (%flonum-hash root))
+                   (else (name-hash (number->string root)))))
+         #xffffff))
+
+;; Get the index of the bucket of BUCKETS holding the node of a shared node
+;; pool with ROOT, LEFT and RIGHT, or of the empty bucket where it belongs.
+(define (node-bucket-index pool buckets root left right)
+  (let ((size (vector-length buckets)))
+    (let probe ((i (fxmod (node-hash root left right) size)))
+      (let ((node (vector-ref buckets i)))
+        (if (or (not node)
+                (and (eqv? (node-pool-root pool node) root)
+                     (eqv? (node-pool-left pool node) left)
+                     (eqv? (node-pool-right pool node) right)))
+            i
+            (probe (if (fx= (fx+ i 1) size) 0 (fx+ i 1))))))))
+
+;; Double the buckets of a shared node pool, rehashing its nodes.
+(define (node-pool-rehash! pool)
+  (let ((buckets (make-vector (fx* 2 (vector-length (node-pool-buckets pool)))
+                              #f)))
+    (do ((node 0 (fx+ node 1)))
+        ((fx= node (node-pool-length pool)))
+      (vector-set! buckets
+                   (node-bucket-index pool
+                                      buckets
+                                      (node-pool-root pool node)
+                                      (node-pool-left pool node)
+                                      (node-pool-right pool node))
+                   node))
+    (node-pool-buckets-set! pool buckets)))
+
+;; Get the index of the node of a shared node pool with ROOT and the child
+;; nodes LEFT and RIGHT, adding it if there is none. Leaves are equal when
+;; their numbers are eqv? or their variables the same, and operator nodes
+;; when their operators and child indexes are.
+(define (node-pool-intern! pool root left right)
+  (when (fx>= (fx* 2 (fx+ (node-pool-length pool) 1))
+              (vector-length (node-pool-buckets pool)))
+    (node-pool-rehash! pool))
+  (let* ((buckets (node-pool-buckets pool))
+         (i (node-bucket-index pool buckets root left right)))
+    (or (vector-ref buckets i)
+        (let ((node (node-pool-append! pool root left right)))
+          (vector-set! buckets i node)
+          node))))
+
+;; Add a node with ROOT and the child nodes LEFT and RIGHT to a node pool and
+;; return its index, or the index of the equal node a shared pool holds.
+;; Absent children are given as #f.
+(define (node-pool-add! pool root #!optional left right)
+  (if (node-pool-buckets pool)
+      (node-pool-intern! pool root left right)
+      (node-pool-append! pool root left right)))
+
+;; Get the root value of the Ith node of a node pool.
+(define (node-pool-root pool i)
+  (vector-ref (node-pool-roots pool) i))
+
+;; Get the index of the left child of the Ith node of a node pool, or #f.
+(define (node-pool-left pool i)
+  (let ((left (s32vector-ref (node-pool-lefts pool) i)))
+    (and (fx>= left 0) left)))
+
+;; Get the index of the right child of the Ith node of a node pool, or #f.
+(define (node-pool-right pool i)
+  (let ((right (s32vector-ref (node-pool-rights pool) i)))
+    (and (fx>= right 0) right)))
+
+;; Get the root value of a node of a binary tree, a tree record or the index
+;; of a node of POOL.
+(define (node-root pool node)
+  (if pool (node-pool-root pool node) (tree-root node)))
+
+;; Get the left child of a node of a binary tree, or #f.
+(define (node-left pool node)
+  (if pool (node-pool-left pool node) (tree-left node)))
+
+;; Get the right child of a node of a binary tree, or #f.
+(define (node-right pool node)
+  (if pool (node-pool-right pool node) (tree-right node)))
+
+;; Add the nodes of a tree record to a node pool and return the index of its
+;; root node.
+(define (node-pool-add-tree! pool tree)
+  (if (tree-left tree)
+      (let* ((left (node-pool-add-tree! pool (tree-left tree)))
+             (right (node-pool-add-tree! pool (tree-right tree))))
+        (node-pool-add! pool (tree-root tree) left right))
+      (node-pool-add! pool (tree-root tree))))
+
+;; Count the parents of each node of a shared node pool reachable from the
+;; node ROOT, counting a parent once for each of its children that is the
+;; node, and return the counts as an s32vector indexed by node, or #f when
+;; POOL is not a shared pool.
+(define (node-pool-parents pool root)
+  (and pool
+       (node-pool-shared? pool)
+       (let ((parents (make-s32vector (fx+ root 1) 0)))
+         (define (count-parent! child)
+           (s32vector-set! parents child (fx+ (s32vector-ref parents child) 1))
+           (when (fx= (s32vector-ref parents child) 1)
+             (count-parents! child)))
+         (define (count-parents! node)
+           (when (node-pool-left pool node)
+             (count-parent! (node-pool-left pool node))
+             (count-parent! (node-pool-right pool node))))
+         (count-parents! root)
+         parents)))
+
+;; Get the variables of a binary tree, without duplicates, in order of slot.
+(define (tree-variables tree #!optional pool)
+  (define visited (and pool (make-u8vector (fx+ tree 1) 0)))
+  (define (insert variable variables)
+    (cond ((or (null? variables)
+               (fx< (variable-slot variable) (variable-slot (car variables))))
+           (cons variable variables))
+          ((eq? variable (car variables)) variables)
+          (else (cons (car variables) (insert variable (cdr variables))))))
+  (let collect ((node tree)
+                (variables '()))
+    (if (and visited (fx= (u8vector-ref visited node) 1))
+        variables
+        (let ((root (node-root pool node))
+              (left (node-left pool node)))
+          (when visited
+            (u8vector-set! visited node 1))
+          (cond (left
+                 (collect (node-right pool node) (collect left variables)))
+                ((variable? root) (insert root variables))
+                (else variables))))))
+
+;; Determine if the string NAME is a C identifier.
+(define (c-identifier? name)
+  (and (fx> (string-length name) 0)
+       (not (char-numeric? (string-ref name 0)))
+       (let loop ((i 0))
+         (or (fx= i (string-length name))
+             (let ((char (string-ref name i)))
+               (and (or (char-alphabetic? char)
+                        (char-numeric? char)
+                        (char=? char #\_))
+                    (char<? char #\x80)
+                    (loop (fx+ i 1))))))))
+
+;; Get the C literal of a number as a double.
+(define (number->c-literal number)
+  (let ((value (exact->inexact number)))
+    (cond ((not (= value value)) "(0.0 / 0.0)")
+          ((= value +inf.0) "(1.0 / 0.0)")
+          ((= value -inf.0) "(-1.0 / 0.0)")
+          (else
+           (let* ((str (number->string value))
+                  (str (if (or (substring-index "." str)
+                               (substring-index "e" str))
+                           str
+                           (string-append str ".0"))))
+             (if (char=? (string-ref str 0) #\-)
+                 (string-append "(" str ")")
+                 str))))))
+
+;; Write a traversal of a binary tree to PORT, separating values with single
+;; spaces. The c fix writes the C functions NAME, computing the tree from an
+;; array of variables, and NAME_n, computing it over columns of them.
+(define (write-traversal fix tree port #!optional pool (name "xpr"))
+  (define separate #f)
+  ;; How variables are written: by name, or in C as an element of the vars
+  ;; array or of the column of their slot.
+  (define variable-style 'name)
+  ;; Names of the C temporaries of shared nodes, indexed by node, or #f.
+  (define temporaries #f)
+
+  (define (temporary node)
+    (and temporaries (vector-ref temporaries node)))
+
+  (define (emit value)
+    (if separate
+        (write-char #\space port)
+        (set! separate #t))
+    (cond ((char? value) (write-char value port))
+          ((string? value) (display value port))
+          ((not (variable? value))
+           (display (if (eq? fix 'c) (number->c-literal value) value) port))
+          ((eq? variable-style 'name) (display (variable-name value) port))
+          ((eq? variable-style 'scalar)
+           (display "vars[" port)
+           (display (variable-slot value) port)
+           (display "]" port))
+          (else
+           (display "col" port)
+           (display (variable-slot value) port)
+           (display "[i]" port))))
+
   (define (preorder tree)
     (when tree
-      (format #t "~A " (tree-root tree))
-      (preorder (tree-left tree))
-      (preorder (tree-right tree))))
+      (emit (node-root pool tree))
+      (preorder (node-left pool tree))
+      (preorder (node-right pool tree))))
 
   (define (inorder tree)
     (when tree
-      (inorder (tree-left tree))
-      (format #t "~A " (tree-root tree))
-      (inorder (tree-right tree))))
+      (let ((temporary (temporary tree)))
+        (if temporary
+            (emit temporary)
+            (inorder-value tree)))))
+
+  ;; Traverse a node in order, even when it has a temporary.
+  (define (inorder-value tree)
+    (inorder-operand (node-left pool tree) tree <)
+    (emit (node-root pool tree))
+    (inorder-operand (node-right pool tree) tree <=))
+
+  ;; Traverse an operand of PARENT in order, parenthesizing it when its
+  ;; precedence compared to that of PARENT by LOOSER? is true.
+  (define (inorder-operand tree parent looser?)
+    (if (and tree
+             (node-left pool tree)
+             (not (temporary tree))
+             (looser? (operator-precedence (node-root pool tree))
+                      (operator-precedence (node-root pool parent))))
+        (begin (emit #\()
+               (inorder tree)
+               (emit #\)))
+        (inorder tree)))
 
   (define (postorder tree)
     (when tree
-      (postorder (tree-left tree))
-      (postorder (tree-right tree))
-      (format #t "~A " (tree-root tree))))
-
-  (let* ((str (with-output-to-string
-                (lambda ()
-                  (case fix
-                    ((prefix) (preorder tree))
-                    ((infix) (inorder tree))
-                    ((postfix) (postorder tree))))))
-         (len (string-length str)))
-    (substring str 0 (- len 1))))
+      (postorder (node-left pool tree))
+      (postorder (node-right pool tree))
+      (emit (node-root pool tree))))
+
+  ;; Write the definitions of the temporaries, indented by INDENT.
+  (define (c-temporaries tree indent)
+    (when temporaries
+      (do ((node 0 (fx+ node 1)))
+          ((fx> node tree))
+        (when (temporary node)
+          (display indent port)
+          (display "const double " port)
+          (display (temporary node) port)
+          (display " = " port)
+          (set! separate #f)
+          (inorder-value node)
+          (display ";\n" port)))))
+
+  (define (c-function tree)
+    (define macro (list->string (map char-upcase (string->list name))))
+    (define (line . strings)
+      (for-each (lambda (str) (display str port)) strings)
+      (newline port))
+    (unless (c-identifier? name)
+      (error "write-traversal: Invalid C function name" name))
+    (let ((parents (node-pool-parents pool tree)))
+      (when parents
+        (set! temporaries (make-vector (fx+ tree 1) #f))
+        (do ((node 0 (fx+ node 1)))
+            ((fx> node tree))
+          (when (and (fx> (s32vector-ref parents node) 1)
+                     (node-left pool node))
+            (vector-set! temporaries
+                         node
+                         (string-append "t" (number->string node)))))))
+    (line "#include <stddef.h>")
+    (line)
+    (line "#ifndef " macro "_RESTRICT")
+    (line "#ifdef __cplusplus")
+    (line "#define " macro "_RESTRICT __restrict")
+    (line "#else")
+    (line "#define " macro "_RESTRICT restrict")
+    (line "#endif")
+    (line "#endif")
+    (line)
+    (let ((variables (tree-variables tree pool)))
+      (when (pair? variables)
+        (line "/* Indexes of the variables in vars and cols. */")
+        (line "enum {")
+        (let loop ((variables variables))
+          (line "    " macro "_VAR_" (variable-name (car variables))
+                " = " (variable-slot (car variables))
+                (if (pair? (cdr variables)) "," ""))
+          (when (pair? (cdr variables))
+            (loop (cdr variables))))
+        (line "};")
+        (line)))
+    (line "double " name "(const double* vars)")
+    (line "{")
+    (set! variable-style 'scalar)
+    (c-temporaries tree "    ")
+    (line "    (void)vars;")
+    (display "    return " port)
+    (set! separate #f)
+    (inorder tree)
+    (line ";")
+    (line "}")
+    (line)
+    (line "void " name "_n(size_t n, const double* const* cols, double* "
+          macro "_RESTRICT out)")
+    (line "{")
+    (for-each (lambda (variable)
+                (line "    const double* " macro "_RESTRICT col"
+                      (variable-slot variable)
+                      " = cols[" (variable-slot variable) "];"))
+              (tree-variables tree pool))
+    (line "    size_t i;")
+    (line "    (void)cols;")
+    (line "    for (i = 0; i < n; i++) {")
+    (set! variable-style 'column)
+    (c-temporaries tree "        ")
+    (display "        out[i] = " port)
+    (set! separate #f)
+    (inorder tree)
+    (line ";")
+    (line "    }")
+    (display "}" port))
+
+  (case fix
+    ((prefix) (preorder tree))
+    ((infix) (inorder tree))
+    ((postfix) (postorder tree))
+    ((c) (c-function tree))))
+
+;; Get the string representation of a traversal of a binary tree.
+(define (traverse fix tree #!optional pool (name "xpr"))
+  (call-with-output-string
+   (lambda (port)
+     (write-traversal fix tree port pool name))))
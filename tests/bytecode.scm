@@ -0,0 +1,72 @@
+;;;; bytecode.scm - Tests of the bytecode compiler.
+
+(declare (uses bytecode)
+         (uses check)
+         (uses evaluator)
+         (uses lexer)
+         (uses parser)
+         (uses tree))
+
+(import srfi-4)
+
+(define bindings (vector 3 -2))
+(define flonum-bindings (f64vector 3.0 -2.0))
+
+;; Bytecode compiled from a tree computes the value eval-tree does.
+(for-each
+ (lambda (xpr)
+   (let* ((pool (make-node-pool))
+          (root (parse-xpr 'infix (lex-xpr xpr) pool #f #f symbols))
+          (bytecode (compile-tree-bytecode root pool)))
+     (check-close xpr
+                  (eval-tree root pool bindings)
+                  (run-bytecode bytecode flonum-bindings))))
+ '("1"
+   "x"
+   "1 + 2 * 3"
+   "(1 + 2) * 3"
+   "x * x - y / 4"
+   "2.5 * (x - y) / (y + 0.5)"
+   "x - (y - (x - 1))"
+   "8 / 2 / 2"))
+
+;; In a shared pool, a repeated subtree is computed once, stored, and loaded
+;; again.
+(let* ((tree (parse "(x * y + 1) * (x * y + 1) - (x * y + 1)"))
+       (pool (make-node-pool 64 #t))
+       (root (node-pool-add-tree! pool tree))
+       (bytecode (compile-tree-bytecode root pool)))
+  (check-close "shared pool"
+               (eval-tree tree #f bindings)
+               (run-bytecode bytecode flonum-bindings))
+  (check "shared pool instructions"
+         (= 10 (u32vector-length (bytecode-code bytecode))))
+  (check "shared pool temporaries"
+         (= 1 (f64vector-length (bytecode-temporaries bytecode)))))
+
+;; Running bytecode again allocates no more for many instructions than for
+;; one, so no value it computes is boxed.
+(let ((short (compile-tree-bytecode (parse "x")))
+      (long (compile-tree-bytecode (parse (repeat-sum "x * y - 2.5" 100)))))
+  (run-bytecode! short flonum-bindings)
+  (run-bytecode! long flonum-bindings)
+  (check "rerun allocates nothing"
+         (<= (nursery-allocation
+              (lambda () (run-bytecode! long flonum-bindings)))
+             (+ (nursery-allocation
+                 (lambda () (run-bytecode! short flonum-bindings)))
+                64))))
+
+;; Postfix tokens compile directly.
+(check-close "postfix tokens"
+             15
+             (run-bytecode (compile-bytecode (lex-xpr "3 2 + x *") symbols)
+                           flonum-bindings))
+
+;; Invalid postfix expressions are refused.
+(check-error "too few operands"
+             (lambda () (compile-bytecode (lex-xpr "1 +") symbols)))
+(check-error "too many operands"
+             (lambda () (compile-bytecode (lex-xpr "1 2") symbols)))
+
+(check-exit)
@@ -0,0 +1,74 @@
+;;;; check.scm - Checks and fixtures shared by the test programs.
+
+(declare (unit check)
+         (uses lexer)
+         (uses parser)
+         (uses symbols))
+
+(import (chicken foreign)
+        (chicken format)
+        (chicken gc))
+
+;; Symbol table of the variables x and y, in slots x and y.
+(define symbols (make-symbol-table))
+(define x (symbol-table-intern! symbols "x"))
+(define y (symbol-table-intern! symbols "y"))
+
+;; Parse an infix expression over SYMBOLS into a tree record.
+(define (parse xpr)
+  (parse-xpr 'infix (lex-xpr xpr) #f #f #f symbols))
+
+;; Get the infix expression adding COUNT copies of TERM.
+(define (repeat-sum term count)
+  (do ((i 1 (+ i 1))
+       (xpr term (string-append xpr " + " term)))
+      ((>= i count) xpr)))
+
+;; Get the free bytes of the nursery, the C stack CHICKEN allocates on.
+(define nursery-free
+  (foreign-lambda* long ()
+    "C_return((C_byte *)C_stack_pointer - (C_byte *)C_stack_limit);"))
+
+;; Get the bytes of the nursery taken up by calling THUNK, after a minor
+;; collection has emptied it.
+(define (nursery-allocation thunk)
+  (gc #f)
+  (let ((free (nursery-free)))
+    (thunk)
+    (- free (nursery-free))))
+
+;; Number of checks that have failed.
+(define check-failures 0)
+
+;; Check that VALUE is true, reporting the check named NAME when it is not.
+(define (check name value)
+  (unless value
+    (set! check-failures (+ check-failures 1))
+    (format #t "FAIL: ~A~%" name)))
+
+;; Check that the number ACTUAL is within a relative error of 1e-12 of
+;; EXPECTED, or that both are NaN.
+(define (check-close name expected actual)
+  (let ((expected (exact->inexact expected))
+        (actual (exact->inexact actual)))
+    (check (format #f "~A: expected ~A, got ~A" name expected actual)
+           (or (= expected actual)
+               (and (not (= expected expected)) (not (= actual actual)))
+               (<= (abs (- expected actual))
+                   (* 1e-12 (max (abs expected) (abs actual))))))))
+
+;; Check that calling THUNK raises an error.
+(define (check-error name thunk)
+  (check name
+         (call-with-current-continuation
+          (lambda (return)
+            (with-exception-handler
+             (lambda (condition) (return #t))
+             (lambda () (thunk) #f))))))
+
+;; Exit with the status of the checks made.
+(define (check-exit)
+  (if (= check-failures 0)
+      (exit 0)
+      (begin (format #t "~A checks failed~%" check-failures)
+             (exit 1))))
@@ -0,0 +1,109 @@
+;;;; columns.scm - Tests of columnar evaluation.
+
+(declare (uses check)
+         (uses columns)
+         (uses evaluator)
+         (uses tree))
+
+(import srfi-4)
+
+;; Make the columns of x and y for ROWS rows.
+(define (make-columns rows)
+  (let ((xs (make-f64vector rows 0.0))
+        (ys (make-f64vector rows 0.0)))
+    (do ((row 0 (+ row 1)))
+        ((= row rows))
+      (f64vector-set! xs row (exact->inexact (- row 7)))
+      (f64vector-set! ys row (+ 0.5 (* 0.25 row))))
+    (vector xs ys)))
+
+;; Check that COLUMN holds the value of TREE for each row of COLUMNS.
+(define (check-rows name tree columns column)
+  (let* ((xs (vector-ref columns 0))
+         (ys (vector-ref columns 1))
+         (rows (f64vector-length xs)))
+    (check (string-append name ": length") (= rows (f64vector-length column)))
+    (do ((row 0 (+ row 1)))
+        ((= row (min rows (f64vector-length column))))
+      (check-close (string-append name ": row " (number->string row))
+                   (eval-tree tree
+                              #f
+                              (vector (f64vector-ref xs row)
+                                      (f64vector-ref ys row)))
+                   (f64vector-ref column row)))))
+
+(define expressions
+  '("x"
+    "2.5"
+    "x + 1"
+    "1 - x"
+    "x * y"
+    "y / x"
+    "(x - y) * (x + y) / 3"
+    "2 * 3 + x"
+    "(x * y + 1) * (x * y + 1) - y"))
+
+;; Row counts that are not multiples of the chunk size are evaluated fully,
+;; with the default chunk size and with a small one.
+(for-each
+ (lambda (rows)
+   (let ((columns (make-columns rows)))
+     (for-each
+      (lambda (xpr)
+        (let ((tree (parse xpr))
+              (name (string-append xpr ", " (number->string rows) " rows")))
+          (check-rows name tree columns (eval-columns tree columns))
+          (check-rows (string-append name ", chunks of 7")
+                      tree
+                      columns
+                      (eval-columns tree columns #f 7))))
+      expressions)))
+ '(0 1 7 1023 1024 1025 2500))
+
+;; A tree in a node pool is evaluated as its record is.
+(let* ((columns (make-columns 100))
+       (tree (parse "x * (y - 1)"))
+       (pool (make-node-pool))
+       (root (node-pool-add-tree! pool tree)))
+  (check-rows "pool" tree columns (eval-columns root columns pool)))
+
+;; Fused outputs match separate runs, including for repeated trees, trees
+;; sharing subtrees, lone columns and constants.
+(for-each
+ (lambda (rows)
+   (let* ((columns (make-columns rows))
+          (trees (map parse (append expressions '("x * y" "x")))))
+     (for-each
+      (lambda (chunk-size)
+        (let loop ((trees trees)
+                   (outputs (eval-columns-fused trees columns #f chunk-size))
+                   (i 0))
+          (when (pair? trees)
+            (let ((expected (eval-columns (car trees) columns))
+                  (name (string-append "fused output "
+                                       (number->string i)
+                                       ", "
+                                       (number->string rows)
+                                       " rows")))
+              (check (string-append name ": length")
+                     (= (f64vector-length expected)
+                        (f64vector-length (car outputs))))
+              (do ((row 0 (+ row 1)))
+                  ((= row (min rows (f64vector-length (car outputs)))))
+                (check-close name
+                             (f64vector-ref expected row)
+                             (f64vector-ref (car outputs) row))))
+            (loop (cdr trees) (cdr outputs) (+ i 1)))))
+      '(7 1024))))
+ '(1 1025 2500))
+
+;; Fused trees given as nodes of a pool are evaluated as their records are.
+(let* ((columns (make-columns 50))
+       (pool (make-node-pool))
+       (first (node-pool-add-tree! pool (parse "x + y")))
+       (second (node-pool-add-tree! pool (parse "(x + y) * 2")))
+       (outputs (eval-columns-fused (list first second) columns pool)))
+  (check-rows "fused pool 0" (parse "x + y") columns (car outputs))
+  (check-rows "fused pool 1" (parse "(x + y) * 2") columns (cadr outputs)))
+
+(check-exit)
@@ -0,0 +1,56 @@
+;;;; evaluator.scm - Tests of the tree evaluators.
+
+(declare (uses check)
+         (uses evaluator)
+         (uses tree))
+
+;; Closures compiled from a tree compute the value eval-tree does, for exact
+;; and inexact bindings, and for the tree in a record or in a node pool.
+(for-each
+ (lambda (bindings)
+   (for-each
+    (lambda (xpr)
+      (let* ((tree (parse xpr))
+             (pool (make-node-pool))
+             (root (node-pool-add-tree! pool tree))
+             (expected (eval-tree tree #f bindings)))
+        (check (string-append xpr ": closure")
+               (equal? expected ((compile-tree tree) bindings)))
+        (check (string-append xpr ": pool closure")
+               (equal? expected ((compile-tree root pool) bindings)))
+        (check (string-append xpr ": pool")
+               (equal? expected (eval-tree root pool bindings)))))
+    '("7"
+      "y"
+      "1 + 2 * 3"
+      "x + 1"
+      "1 - x"
+      "x * y"
+      "y / 4"
+      "(x - y) * (x + y) / 3"
+      "x - (y - (x - 1)) * 2.5"
+      "7 / 2 + x / y")))
+ (list (vector 3 -2) (vector 1.5 0.25)))
+
+;; A shared pool computes or compiles a repeated subtree once and gets the
+;; same value.
+(let* ((pool (make-node-pool 64 #t))
+       (tree (parse "(x * y + 1) * (x * y + 1) - (x * y + 1)"))
+       (root (node-pool-add-tree! pool tree))
+       (bindings (vector 2 5)))
+  (check "shared pool nodes" (< (node-pool-length pool) 9))
+  (check "shared pool value"
+         (equal? (eval-tree tree #f bindings)
+                 (eval-tree root pool bindings)))
+  (check "shared pool closure"
+         (equal? (eval-tree tree #f bindings)
+                 ((compile-tree root pool) bindings))))
+
+;; Dividing by an exact zero is an error, while an inexact zero follows IEEE
+;; 754.
+(check-error "exact division by zero"
+             (lambda () ((compile-tree (parse "x / 0")) (vector 1 0))))
+(check "inexact division by zero"
+       (= +inf.0 ((compile-tree (parse "x / y")) (vector 1.0 0.0))))
+
+(check-exit)
@@ -0,0 +1,69 @@
+;;;; optimizer.scm - Tests of tree simplification.
+
+(declare (uses check)
+         (uses evaluator)
+         (uses optimizer)
+         (uses tree))
+
+;; Simplified trees, written in infix, for records and for node pools, when
+;; folding for evaluation.
+(for-each
+ (lambda (test)
+   (let* ((tree (parse (car test)))
+          (pool (make-node-pool 64 #t))
+          (root (node-pool-add-tree! pool tree)))
+     (check (string-append (car test) " folds to " (cadr test))
+            (string=? (cadr test) (traverse 'infix (fold-tree tree))))
+     (check (string-append (car test) " folds to " (cadr test) " in a pool")
+            (string=? (cadr test)
+                      (traverse 'infix (fold-pool! pool root) pool)))))
+ '(("1 + 2 * 3" "7")
+   ("x + 0" "x")
+   ("0 + x" "x")
+   ("x - 0" "x")
+   ("x * 1" "x")
+   ("1 * x" "x")
+   ("x / 1" "x")
+   ("(2 - 1) * x + (3 - 3)" "x")
+   ("x * (4 / 2)" "x * 2")
+   ("x * 0" "x * 0")
+   ("0 * (1 / 0)" "0 * ( 1 / 0 )")
+   ("1 / 3 + x" "1 / 3 + x")
+   ("x * 0.0" "x * 0.0")))
+
+;; Zero is an annihilator when folding for conversion.
+(for-each
+ (lambda (test)
+   (let* ((tree (parse (car test)))
+          (pool (make-node-pool 64 #t))
+          (root (node-pool-add-tree! pool tree)))
+     (check (string-append (car test) " annihilates to " (cadr test))
+            (string=? (cadr test) (traverse 'infix (fold-tree tree #t))))
+     (check (string-append (car test) " annihilates to " (cadr test)
+                           " in a pool")
+            (string=? (cadr test)
+                      (traverse 'infix (fold-pool! pool root #t) pool)))))
+ '(("x * 0" "0")
+   ("0 * x" "0")
+   ("0 * (1 / 0)" "0")
+   ("(x + 1) * 0 + y" "y")
+   ("x * y * (1 - 1)" "0")
+   ("x * 1" "x")
+   ("x * 0.0" "x * 0.0")))
+
+;; Folding for evaluation keeps the errors and IEEE 754 results of the
+;; operands of a zero.
+(check-error "division by zero under a zero"
+             (lambda ()
+               (let ((tree (fold-tree (parse "0 * (1 / 0)"))))
+                 (eval-tree tree #f (vector)))))
+(check-error "unbound variable under a zero"
+             (lambda ()
+               (eval-tree (fold-tree (parse "0 * y")) #f (vector 1))))
+(check "infinity under a zero"
+       (let ((value (eval-tree (fold-tree (parse "0 * x"))
+                               #f
+                               (vector +inf.0))))
+         (not (= value value))))
+
+(check-exit)
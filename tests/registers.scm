@@ -0,0 +1,76 @@
+;;;; registers.scm - Tests of the register machine compiler.
+
+(declare (uses check)
+         (uses evaluator)
+         (uses registers)
+         (uses tree))
+
+(import srfi-4)
+
+(define bindings (vector 3 -2))
+(define flonum-bindings (f64vector 3.0 -2.0))
+
+;; Register programs compute the value eval-tree does, and use the number of
+;; registers Sethi-Ullman numbering gives.
+(for-each
+ (lambda (test)
+   (let* ((xpr (car test))
+          (tree (parse xpr))
+          (pool (make-node-pool))
+          (root (node-pool-add-tree! pool tree))
+          (program (compile-registers tree)))
+     (check-close xpr
+                  (eval-tree tree #f bindings)
+                  (run-registers program flonum-bindings))
+     (check-close (string-append xpr ": pool")
+                  (eval-tree tree #f bindings)
+                  (run-registers (compile-registers root pool)
+                                 flonum-bindings))
+     (check (string-append xpr ": registers")
+            (= (cadr test)
+               (f64vector-length (register-program-registers program))))))
+ '(("7" 1)
+   ("x" 1)
+   ("x + 1" 2)
+   ("1 - x" 2)
+   ("x + 1 + 2 + 3" 2)
+   ("1 - (2 - (3 - x))" 2)
+   ("(x + y) * (x - y)" 3)
+   ("(x + y) * (x - y) / y" 3)
+   ("((x + 1) * (y + 2)) / ((x - 3) * (y - 4))" 4)
+   ("y / 4 - 2.5 * x" 3)))
+
+;; In a shared pool, a repeated subtree is computed once, into a register of
+;; its own.
+(let* ((tree (parse "(x * y + 1) * (x * y + 1) - (x * y + 1)"))
+       (pool (make-node-pool 64 #t))
+       (root (node-pool-add-tree! pool tree))
+       (program (compile-registers root pool)))
+  (check-close "shared pool"
+               (eval-tree tree #f bindings)
+               (run-registers program flonum-bindings))
+  (check "shared pool instructions"
+         (= (* 4 (node-pool-length pool))
+            (u32vector-length (register-program-code program))))
+  (check "shared pool registers"
+         (= 3 (f64vector-length (register-program-registers program)))))
+
+;; Running a program again allocates no more for many instructions than for
+;; one, so no value it computes is boxed.
+(let ((short (compile-registers (parse "x")))
+      (long (compile-registers (parse (repeat-sum "x * y - 2.5" 100)))))
+  (run-registers! short flonum-bindings)
+  (run-registers! long flonum-bindings)
+  (check "rerun allocates nothing"
+         (<= (nursery-allocation
+              (lambda () (run-registers! long flonum-bindings)))
+             (+ (nursery-allocation
+                 (lambda () (run-registers! short flonum-bindings)))
+                64))))
+
+;; A program can be run again with other bindings.
+(let ((program (compile-registers (parse "x * y - x"))))
+  (check-close "first run" -9 (run-registers program flonum-bindings))
+  (check-close "second run" 1.5 (run-registers program (f64vector 1.5 2.0))))
+
+(check-exit)
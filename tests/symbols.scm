@@ -0,0 +1,47 @@
+;;;; symbols.scm - Tests of symbol tables.
+
+(declare (uses check)
+         (uses symbols))
+
+(define names '("a" "b" "c" "d" "e" "f" "g" "h" "i" "j"))
+
+;; Truncating a table that has grown keeps the slots and lookups of the
+;; variables before the size given, and forgets the others, so that
+;; interning them again gives them the next slots.
+(let ((table (make-symbol-table 2)))
+  (for-each (lambda (name) (symbol-table-intern! table name)) names)
+  (check "interned" (= (symbol-table-size table) 10))
+  (symbol-table-truncate! table 3)
+  (check "truncated size" (= (symbol-table-size table) 3))
+  (for-each
+   (lambda (name slot)
+     (let ((variable (symbol-table-lookup table name)))
+       (check (string-append name " kept")
+              (and variable (= (variable-slot variable) slot)))
+       (check (string-append name " kept in its slot")
+              (eq? variable (symbol-table-ref table slot)))))
+   '("a" "b" "c")
+   '(0 1 2))
+  (for-each
+   (lambda (name)
+     (check (string-append name " removed")
+            (not (symbol-table-lookup table name))))
+   '("d" "e" "f" "g" "h" "i" "j"))
+  (check "e interned again"
+         (= (variable-slot (symbol-table-intern! table "e")) 3))
+  (check "d interned again"
+         (= (variable-slot (symbol-table-intern! table "d")) 4))
+  (check "e looked up again"
+         (= (variable-slot (symbol-table-lookup table "e")) 3))
+  (check "a interned again"
+         (= (variable-slot (symbol-table-intern! table "a")) 0))
+  (check "size after interning again" (= (symbol-table-size table) 5)))
+
+;; Truncating to a size no smaller than the table's changes nothing.
+(let ((table (make-symbol-table)))
+  (for-each (lambda (name) (symbol-table-intern! table name)) names)
+  (symbol-table-truncate! table 12)
+  (check "not truncated" (= (symbol-table-size table) 10))
+  (check "j kept" (= (variable-slot (symbol-table-lookup table "j")) 9)))
+
+(check-exit)
@@ -0,0 +1,100 @@
+;;;; tree.scm - Tests of node pools.
+
+(declare (uses check)
+         (uses tree))
+
+(import (chicken string))
+
+(define xprs '("x * y + x * y" "(x + 1) * (x + 1) - y / 2" "x * y"))
+
+;; Add the trees of XPRS to a node pool, giving the indexes of their roots.
+(define (add-trees pool)
+  (map (lambda (xpr) (node-pool-add-tree! pool (parse xpr))) xprs))
+
+;; A shared pool stores equal subtrees once.
+(let* ((pool (make-node-pool 4 #t))
+       (roots (add-trees pool)))
+  (check "equal operands shared"
+         (= (node-pool-left pool (car roots))
+            (node-pool-right pool (car roots))))
+  (check "equal trees shared"
+         (= (caddr roots) (node-pool-left pool (car roots))))
+  (check "shared length" (= (node-pool-length pool) 10)))
+
+;; A shared pool cleared after it has rehashed its buckets gives the same
+;; indexes when the same trees are added again, and still shares them.
+(let* ((pool (make-node-pool 4 #t))
+       (roots (add-trees pool))
+       (size (node-pool-length pool)))
+  (node-pool-clear! pool)
+  (check "cleared" (= (node-pool-length pool) 0))
+  (let ((again (add-trees pool)))
+    (check "same indexes" (equal? roots again))
+    (check "same length" (= (node-pool-length pool) size))
+    (check "shared again"
+           (= (caddr again) (node-pool-left pool (car again))))
+    (check "no new node for a tree held"
+           (= (node-pool-add-tree! pool (parse "x + 1"))
+              (node-pool-left pool (node-pool-left pool (cadr again)))))))
+
+;; The c fix computes each shared operator node once, into a temporary, while
+;; other fixes write the whole tree.
+(let* ((pool (make-node-pool 4 #t))
+       (root (node-pool-add-tree! pool (parse "x * y + x * y"))))
+  (check "temporary of a shared node"
+         (substring-index "const double t2 = vars[0] * vars[1];\n"
+                          (traverse 'c root pool)))
+  (check "shared node read from its temporary"
+         (substring-index "out[i] = t2 + t2;" (traverse 'c root pool)))
+  (check "shared node written in full"
+         (string=? "x * y + x * y" (traverse 'infix root pool))))
+
+;; The c fix writes the functions and macros of the name given.
+(check "c functions"
+       (string=? (traverse 'c (parse "x * y + 2") #f "f")
+                 (string-intersperse
+                  '("#include <stddef.h>"
+                    ""
+                    "#ifndef F_RESTRICT"
+                    "#ifdef __cplusplus"
+                    "#define F_RESTRICT __restrict"
+                    "#else"
+                    "#define F_RESTRICT restrict"
+                    "#endif"
+                    "#endif"
+                    ""
+                    "/* Indexes of the variables in vars and cols. */"
+                    "enum {"
+                    "    F_VAR_x = 0,"
+                    "    F_VAR_y = 1"
+                    "};"
+                    ""
+                    "double f(const double* vars)"
+                    "{"
+                    "    (void)vars;"
+                    "    return vars[0] * vars[1] + 2.0;"
+                    "}"
+                    ""
+                    (string-append
+                     "void f_n(size_t n, const double* const* cols, "
+                     "double* F_RESTRICT out)")
+                    "{"
+                    "    const double* F_RESTRICT col0 = cols[0];"
+                    "    const double* F_RESTRICT col1 = cols[1];"
+                    "    size_t i;"
+                    "    (void)cols;"
+                    "    for (i = 0; i < n; i++) {"
+                    "        out[i] = col0[i] * col1[i] + 2.0;"
+                    "    }"
+                    "}")
+                  "\n")))
+(check-error "invalid c function name"
+             (lambda () (traverse 'c (parse "x") #f "2f")))
+
+;; A pool that is not shared stores every node.
+(let* ((pool (make-node-pool 4))
+       (roots (add-trees pool)))
+  (check "not shared" (not (node-pool-shared? pool)))
+  (check "unshared length" (= (node-pool-length pool) 21)))
+
+(check-exit)